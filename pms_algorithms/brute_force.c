@@ -4,18 +4,59 @@
 #include <stdbool.h>
 #include <math.h>
 #include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "neighbourhood.h"
+#include "task_queue.h"
 
 #define MAX_LINES 1000
 #define MAX_BUFFER 1200
 #define MAX_KMERS 100000000
 #define NUM_SEQ 20
 #define MAX_LINE_LENGTH 100
+#define TASKS_PER_THREAD 16
+#define BITMAP_MEMORY_BUDGET (1ULL << 30)
+#define ENGINE_AUTO 0
+#define ENGINE_SCAN 1
+#define ENGINE_BITMAP 2
 
 typedef struct {
-    char *motif;
+    char **motifs;
     int count;
+    int capacity;
 } MotifResult;
 
+typedef struct {
+    kmer_t *codes;
+    kmer_t *bad;
+    int *offsets;
+    int num_sequences;
+} PackedWindows;
+
+typedef struct {
+    int *order;
+    long long *rejections;
+    long long candidates;
+    long long windows;
+} ScanState;
+
+typedef struct {
+    kmer_t *items;
+    int size;
+    int capacity;
+} MotifList;
+
+typedef struct {
+    TaskQueue *tasks;
+    const PackedWindows *windows;
+    int k;
+    int d;
+    int alphabet_size;
+    int prefix_len;
+    ScanState state;
+    MotifList found;
+} Worker;
+
 int hamming_distance(const char *s1, const char *s2, int length) {
     int distance = 0;
     for (int i = 0; i < length; i++) {
@@ -55,7 +96,22 @@ void free_kmers(char **kmers, int num_kmers) {
     free(kmers);
 }
 
-MotifResult motif_finding_with_mismatches(char **sequences, int num_sequences, int k, int d, char* alphabet, int alphabet_size) {
+void add_motif(MotifResult *result, const char *motif) {
+    if (result->count == result->capacity) {
+        result->capacity = result->capacity > 0 ? result->capacity * 2 : 16;
+        result->motifs = (char **)realloc(result->motifs, result->capacity * sizeof(char *));
+    }
+    result->motifs[result->count++] = strdup(motif);
+}
+
+void free_result(MotifResult *result) {
+    for (int i = 0; i < result->count; i++) {
+        free(result->motifs[i]);
+    }
+    free(result->motifs);
+}
+
+MotifResult motif_finding_with_strings(char **sequences, int num_sequences, int k, int d, char* alphabet, int alphabet_size) {
     /*
         Generate all possible combinations of the nucleotides and for each check if it has neighbours
         in all of the input sequences.
@@ -66,43 +122,383 @@ MotifResult motif_finding_with_mismatches(char **sequences, int num_sequences, i
     int kmer_count = 0;
     generate_all_kmers(all_kmers, k, 0, current_kmer, &kmer_count, alphabet, alphabet_size);
 
-    MotifResult best_motif_result = {NULL, 0};
+    MotifResult result = {NULL, 0, 0};
 
     for (int i = 0; i < num_kmers; i++) {
         char *candidate = all_kmers[i];
-        int *count = (int *)malloc(num_sequences*sizeof(int));
-        for (int s = 0; s<num_sequences; s++){
-            count[s] = 0;
-        }
-
-        for (int j = 0; j < num_sequences; j++) {
+        bool all_seq = true;
+        for (int j = 0; j < num_sequences && all_seq; j++) {
             char *seq = sequences[j];
             int seq_len = strlen(seq);
+            bool found = false;
 
-            for (int m = 0; m <= seq_len - k; m++) {
-                char kmer[k + 1];
-                strncpy(kmer, seq + m, k);
-                kmer[k] = '\0';
-
-                if (hamming_distance(candidate, kmer, k) <= d) {
-                    count[j]=1;
-                }
-            }
-        }
-        bool all_seq = true;
-        for (int w = 0; w < num_sequences; w++) {
-            if (count[w] == 0) {
-                all_seq = false;
+            for (int m = 0; m <= seq_len - k && !found; m++) {
+                found = hamming_distance(candidate, seq + m, k) <= d;
             }
+            all_seq = found;
         }
         if (all_seq) {
-            best_motif_result.motif = strdup(candidate);
+            add_motif(&result, candidate);
         }
-        free(count);
     }
 
     free_kmers(all_kmers, num_kmers);
-    return best_motif_result;
+    return result;
+}
+
+bool next_candidate(kmer_t *candidate, int k, int alphabet_size) {
+    /* Odometer over the alphabet, last position changes fastest so candidates come in lexicographic order. */
+    for (int p = 0; p < k; p++) {
+        int shift = 2 * p;
+        kmer_t digit = (*candidate >> shift) & 3;
+        if (digit + 1 < (kmer_t)alphabet_size) {
+            *candidate += (kmer_t)1 << shift;
+            return true;
+        }
+        *candidate &= ~((kmer_t)3 << shift);
+    }
+    return false;
+}
+
+PackedWindows pack_windows(char **sequences, int num_sequences, int k, const char *alphabet, int alphabet_size) {
+    /* Pack every window of every sequence once, offsets[j]..offsets[j + 1] are the windows of sequence j. */
+    int codes[256];
+    build_symbol_codes(alphabet, alphabet_size, codes);
+
+    PackedWindows windows;
+    windows.num_sequences = num_sequences;
+    windows.offsets = (int *)malloc((num_sequences + 1) * sizeof(int));
+    int total = 0;
+    for (int j = 0; j < num_sequences; j++) {
+        windows.offsets[j] = total;
+        int seq_len = strlen(sequences[j]);
+        if (seq_len >= k) {
+            total += seq_len - k + 1;
+        }
+    }
+    windows.offsets[num_sequences] = total;
+    windows.codes = (kmer_t *)malloc((total > 0 ? total : 1) * sizeof(kmer_t));
+    windows.bad = (kmer_t *)malloc((total > 0 ? total : 1) * sizeof(kmer_t));
+
+    for (int j = 0; j < num_sequences; j++) {
+        char *seq = sequences[j];
+        for (int w = windows.offsets[j]; w < windows.offsets[j + 1]; w++) {
+            int m = w - windows.offsets[j];
+            windows.codes[w] = pack_kmer(&seq[m], k, codes, &windows.bad[w]);
+        }
+    }
+    return windows;
+}
+
+void free_windows(PackedWindows *windows) {
+    free(windows->codes);
+    free(windows->bad);
+    free(windows->offsets);
+}
+
+ScanState create_scan_state(int num_sequences) {
+    ScanState state;
+    state.order = (int *)malloc(num_sequences * sizeof(int));
+    state.rejections = (long long *)calloc(num_sequences, sizeof(long long));
+    for (int j = 0; j < num_sequences; j++) {
+        state.order[j] = j;
+    }
+    state.candidates = 0;
+    state.windows = 0;
+    return state;
+}
+
+void free_scan_state(ScanState *state) {
+    free(state->order);
+    free(state->rejections);
+}
+
+bool candidate_in_all_sequences(kmer_t candidate, const PackedWindows *windows, int d, ScanState *state) {
+    /*
+        Sequences are checked in state->order and the scan of a sequence stops at its first window within distance d.
+        The candidate is rejected at the first sequence without such a window. That sequence's rejection counter grows
+        and once it overtakes its predecessor's the two swap places, so sequences that reject most often drift to the front.
+     */
+    state->candidates++;
+    for (int i = 0; i < windows->num_sequences; i++) {
+        int j = state->order[i];
+        int end = windows->offsets[j + 1];
+        int w = windows->offsets[j];
+        while (w < end && packed_distance(candidate, windows->codes[w], windows->bad[w]) > d) {
+            w++;
+        }
+        if (w < end) {
+            state->windows += w - windows->offsets[j] + 1;
+            continue;
+        }
+        state->windows += end - windows->offsets[j];
+        state->rejections[j]++;
+        if (i > 0 && state->rejections[j] > state->rejections[state->order[i - 1]]) {
+            state->order[i] = state->order[i - 1];
+            state->order[i - 1] = j;
+        }
+        return false;
+    }
+    return true;
+}
+
+void add_packed_motif(MotifList *list, kmer_t motif) {
+    if (list->size == list->capacity) {
+        list->capacity = list->capacity > 0 ? list->capacity * 2 : 16;
+        list->items = (kmer_t *)realloc(list->items, list->capacity * sizeof(kmer_t));
+    }
+    list->items[list->size++] = motif;
+}
+
+int compare_kmers(const void *a, const void *b) {
+    kmer_t x = *(const kmer_t *)a;
+    kmer_t y = *(const kmer_t *)b;
+    return (x > y) - (x < y);
+}
+
+kmer_t prefix_of_task(int task, int prefix_len, int alphabet_size) {
+    /* Writes task number in base alphabet_size as prefix_len packed characters. */
+    kmer_t prefix = 0;
+    for (int p = 0; p < prefix_len; p++) {
+        prefix |= (kmer_t)(task % alphabet_size) << (2 * p);
+        task /= alphabet_size;
+    }
+    return prefix;
+}
+
+void scan_task(Worker *worker, int task) {
+    /* Task covers all candidates that start with one prefix, the suffix is walked by the odometer. */
+    int suffix_len = worker->k - worker->prefix_len;
+    kmer_t prefix = prefix_of_task(task, worker->prefix_len, worker->alphabet_size);
+    kmer_t candidate = prefix << (2 * suffix_len);
+    do {
+        if (candidate_in_all_sequences(candidate, worker->windows, worker->d, &worker->state)) {
+            add_packed_motif(&worker->found, candidate);
+        }
+    } while (next_candidate(&candidate, suffix_len, worker->alphabet_size));
+}
+
+void *run_worker(void *arg) {
+    Worker *worker = (Worker *)arg;
+    int task;
+    while (next_task(worker->tasks, &task)) {
+        scan_task(worker, task);
+    }
+    return NULL;
+}
+
+MotifResult motif_finding_packed(char **sequences, int num_sequences, int k, int d, char* alphabet, int alphabet_size, int num_threads, ScanState *stats) {
+    /*
+        Same search as motif_finding_with_strings, but candidates are 2-bit packed integers walked in place
+        by an odometer, so no table of 4^k candidates is ever built and memory does not depend on k.
+        Candidate space is cut into prefixes that num_threads workers take from a TaskQueue. Each worker keeps
+        its own motifs and counters which are merged at the end, motifs sorted lexicographically.
+     */
+    PackedWindows windows = pack_windows(sequences, num_sequences, k, alphabet, alphabet_size);
+
+    int prefix_len = 0;
+    int num_tasks = 1;
+    while (prefix_len < k && num_tasks < num_threads * TASKS_PER_THREAD && alphabet_size > 1) {
+        prefix_len++;
+        num_tasks *= alphabet_size;
+    }
+
+    TaskQueue tasks = {0, num_tasks};
+    Worker *workers = (Worker *)malloc(num_threads * sizeof(Worker));
+    for (int t = 0; t < num_threads; t++) {
+        workers[t].tasks = &tasks;
+        workers[t].windows = &windows;
+        workers[t].k = k;
+        workers[t].d = d;
+        workers[t].alphabet_size = alphabet_size;
+        workers[t].prefix_len = prefix_len;
+        workers[t].state = create_scan_state(num_sequences);
+        workers[t].found = (MotifList){NULL, 0, 0};
+    }
+
+    run_workers(run_worker, workers, sizeof(Worker), num_threads);
+
+    MotifList all = {NULL, 0, 0};
+    for (int t = 0; t < num_threads; t++) {
+        for (int i = 0; i < workers[t].found.size; i++) {
+            add_packed_motif(&all, workers[t].found.items[i]);
+        }
+        stats->candidates += workers[t].state.candidates;
+        stats->windows += workers[t].state.windows;
+        free(workers[t].found.items);
+        free_scan_state(&workers[t].state);
+    }
+    qsort(all.items, all.size, sizeof(kmer_t), compare_kmers);
+
+    MotifResult result = {NULL, 0, 0};
+    char motif[MAX_PACKED_LEN + 1];
+    for (int i = 0; i < all.size; i++) {
+        unpack_kmer(all.items[i], k, alphabet, motif);
+        add_motif(&result, motif);
+    }
+
+    free(all.items);
+    free(workers);
+    free_windows(&windows);
+    return result;
+}
+
+void mark_neighbourhood(uint64_t *bitmap, kmer_t window, kmer_t bad, int pos, int k, int d, kmer_t current, int alphabet_size) {
+    /*
+        Recursively sets the bit of every l-mer within distance d of the window. At each position the window's own
+        character is kept with the same d, or replaced by every other character with d - 1. A position holding a character
+        outside of the alphabet is a mismatch whatever is put there. Once d is spent the rest of the window is copied as is.
+     */
+    int rest = 2 * (k - pos);
+    kmer_t rest_mask = rest == 64 ? ~(kmer_t)0 : (((kmer_t)1 << rest) - 1);
+    if (d == 0 || pos == k) {
+        if ((bad & rest_mask) == 0) {
+            kmer_t code = current | (window & rest_mask);
+            bitmap[code >> 6] |= 1ULL << (code & 63);
+        }
+        return;
+    }
+    int shift = rest - 2;
+    kmer_t own = (window >> shift) & 3;
+    bool is_bad = (bad >> shift) & 1;
+    if (!is_bad) {
+        mark_neighbourhood(bitmap, window, bad, pos + 1, k, d, current | (own << shift), alphabet_size);
+    }
+    for (int a = 0; a < alphabet_size; a++) {
+        if (is_bad || (kmer_t)a != own) {
+            mark_neighbourhood(bitmap, window, bad, pos + 1, k, d - 1, current | ((kmer_t)a << shift), alphabet_size);
+        }
+    }
+}
+
+typedef struct {
+    TaskQueue *tasks;
+    const PackedWindows *windows;
+    int k;
+    int d;
+    int alphabet_size;
+    size_t num_words;
+    uint64_t *common;
+    uint64_t *current;
+    pthread_mutex_t *lock;
+    bool *empty;
+} BitmapWorker;
+
+void *run_bitmap_worker(void *arg) {
+    /*
+        Takes sequences one at a time, marks the neighbourhoods of their windows in its own bitmap and ANDs it into
+        the common one. AND does not depend on the order, so sequences can be done in any order. Once the common
+        bitmap is empty there are no motifs and the remaining sequences are skipped.
+     */
+    BitmapWorker *worker = (BitmapWorker *)arg;
+    const PackedWindows *windows = worker->windows;
+    int j;
+    while (!__atomic_load_n(worker->empty, __ATOMIC_RELAXED) && next_task(worker->tasks, &j)) {
+        memset(worker->current, 0, worker->num_words * sizeof(uint64_t));
+        for (int w = windows->offsets[j]; w < windows->offsets[j + 1]; w++) {
+            mark_neighbourhood(worker->current, windows->codes[w], windows->bad[w], 0, worker->k, worker->d, 0, worker->alphabet_size);
+        }
+        pthread_mutex_lock(worker->lock);
+        bool any = false;
+        for (size_t i = 0; i < worker->num_words; i++) {
+            worker->common[i] &= worker->current[i];
+            any |= worker->common[i] != 0;
+        }
+        if (!any) {
+            __atomic_store_n(worker->empty, true, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(worker->lock);
+    }
+    return NULL;
+}
+
+MotifResult motif_finding_bitmap(char **sequences, int num_sequences, int k, int d, char* alphabet, int alphabet_size, int num_threads) {
+    /*
+        Instead of testing candidates against windows, mark the whole d-neighbourhood of every window of a sequence
+        in a bitmap with one bit per l-mer and AND it into the common bitmap, which starts with every bit set.
+        Sequences are marked by num_threads workers, each with its own bitmap. Bits left standing at the end
+        are the motifs, read in increasing order they are already lexicographically sorted.
+     */
+    PackedWindows windows = pack_windows(sequences, num_sequences, k, alphabet, alphabet_size);
+    size_t num_words = ((1ULL << (2 * k)) + 63) / 64;
+    uint64_t *common = (uint64_t *)malloc(num_words * sizeof(uint64_t));
+    if (common == NULL) {
+        perror("Failed to malloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(common, 0xff, num_words * sizeof(uint64_t));
+
+    TaskQueue tasks = {0, num_sequences};
+    pthread_mutex_t lock;
+    pthread_mutex_init(&lock, NULL);
+    bool empty = num_sequences == 0;
+    BitmapWorker *workers = (BitmapWorker *)malloc(num_threads * sizeof(BitmapWorker));
+    for (int t = 0; t < num_threads; t++) {
+        uint64_t *current = (uint64_t *)malloc(num_words * sizeof(uint64_t));
+        if (current == NULL) {
+            perror("Failed to malloc");
+            exit(EXIT_FAILURE);
+        }
+        workers[t] = (BitmapWorker){&tasks, &windows, k, d, alphabet_size, num_words, common, current, &lock, &empty};
+    }
+    run_workers(run_bitmap_worker, workers, sizeof(BitmapWorker), num_threads);
+    for (int t = 0; t < num_threads; t++) {
+        free(workers[t].current);
+    }
+    free(workers);
+    pthread_mutex_destroy(&lock);
+
+    MotifResult result = {NULL, 0, 0};
+    char motif[MAX_PACKED_LEN + 1];
+    for (size_t i = 0; i < num_words && !empty; i++) {
+        uint64_t word = common[i];
+        while (word) {
+            kmer_t code = (kmer_t)i * 64 + __builtin_ctzll(word);
+            unpack_kmer(code, k, alphabet, motif);
+            add_motif(&result, motif);
+            word &= word - 1;
+        }
+    }
+
+    free(common);
+    free_windows(&windows);
+    return result;
+}
+
+int bitmap_threads(int k, int num_threads) {
+    /*
+        Bitmap search needs the common bitmap of 4^k bits and one more for every thread.
+        Returns how many threads fit in BITMAP_MEMORY_BUDGET, at most num_threads, 0 if not even one does.
+     */
+    if (2 * k >= 64) {
+        return 0;
+    }
+    unsigned long long bitmap_bytes = ((1ULL << (2 * k)) + 7) / 8;
+    unsigned long long fitting = BITMAP_MEMORY_BUDGET / bitmap_bytes;
+    if (fitting < 2) {
+        return 0;
+    }
+    return fitting - 1 < (unsigned long long)num_threads ? (int)(fitting - 1) : num_threads;
+}
+
+MotifResult motif_finding_with_mismatches(char **sequences, int num_sequences, int k, int d, char* alphabet, int alphabet_size, int num_threads, int engine, ScanState *stats) {
+    /*
+        Packed search fits alphabets of at most 4 characters and motifs of at most 32 characters, otherwise use strings.
+        Unless the engine is given, bitmap search is used whenever two of its bitmaps fit in BITMAP_MEMORY_BUDGET,
+        with as many of num_threads threads as there is memory for. Bitmap search is never run when they do not fit,
+        main rejects it when it is asked for. The engine that runs is printed.
+     */
+    if (alphabet_size > 4 || k > MAX_PACKED_LEN) {
+        printf("Nacin pretrage: niske\n");
+        return motif_finding_with_strings(sequences, num_sequences, k, d, alphabet, alphabet_size);
+    }
+    int threads = bitmap_threads(k, num_threads);
+    if (threads > 0 && engine != ENGINE_SCAN) {
+        printf("Nacin pretrage: bitmap (niti: %d)\n", threads);
+        return motif_finding_bitmap(sequences, num_sequences, k, d, alphabet, alphabet_size, threads);
+    }
+    printf("Nacin pretrage: scan (niti: %d)\n", num_threads);
+    return motif_finding_packed(sequences, num_sequences, k, d, alphabet, alphabet_size, num_threads, stats);
 }
 
 char **read_lines_from_file(const char *file_path, int *num_sequences) {
@@ -146,41 +542,86 @@ char* read_alphabet(const char *file_name, int *num_chars) {
     }
 }
 
+double wall_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 int main(int argc, char *argv[]) {
 
-    if (argc < 4) {
-        fprintf(stderr, "Argumenti: <duzina_motiva> <broj_mutacija> <datoteka_sa_sekvencama> [<datoteka_sa_azbukom>]\n");
+    /* Options may appear anywhere, what is left are positional arguments. */
+    int num_threads = 1;
+    int engine = ENGINE_AUTO;
+    char *args[5];
+    int num_args = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            num_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "scan") == 0) {
+                engine = ENGINE_SCAN;
+            } else if (strcmp(argv[i], "bitmap") == 0) {
+                engine = ENGINE_BITMAP;
+            } else {
+                fprintf(stderr, "Nepoznat nacin pretrage: %s (scan ili bitmap).\n", argv[i]);
+                return 1;
+            }
+        } else if (num_args < 5) {
+            args[num_args++] = argv[i];
+        }
+    }
+
+    if (num_args < 4) {
+        fprintf(stderr, "Argumenti: <duzina_motiva> <broj_mutacija> <datoteka_sa_sekvencama> [<datoteka_sa_azbukom>] [--threads <broj_niti>] [--engine scan|bitmap]\n");
         return 1;
     }
 
-    int l = atoi(argv[1]);
-    int d = atoi(argv[2]);
+    int l = atoi(args[1]);
+    int d = atoi(args[2]);
 
     if (l<0 || d<0){
         fprintf(stderr, "Argumenti duzina motiva i dozvoljene mutacije moraju biti veci od 0.\n");
         return 1;
     }
+    if (num_threads < 1) {
+        fprintf(stderr, "Broj niti mora biti veci od 0.\n");
+        return 1;
+    }
 
     int num_sequences;
-    char **sequences = read_lines_from_file(argv[3], &num_sequences);
+    char **sequences = read_lines_from_file(args[3], &num_sequences);
 
-    char *alphabet = (char *)malloc(25*sizeof(char));
+    char *alphabet;
     int alphabet_size;
 
-    if (argc == 5) {
-        alphabet = read_alphabet(argv[4], &alphabet_size);
+    if (num_args == 5) {
+        alphabet = read_alphabet(args[4], &alphabet_size);
     } else{
         alphabet = strdup("acgt");
         alphabet_size = 4;
     }
 
-    clock_t start = clock();
-    MotifResult result = motif_finding_with_mismatches(sequences, num_sequences, l, d, alphabet, alphabet_size);
-    clock_t end = clock();
+    if (engine == ENGINE_BITMAP && alphabet_size <= 4 && l <= MAX_PACKED_LEN && bitmap_threads(l, 1) == 0) {
+        fprintf(stderr, "Pretraga bitmapom za l = %d ne staje u %llu MB memorije, koristite --engine scan.\n", l, BITMAP_MEMORY_BUDGET >> 20);
+        return 1;
+    }
+
+    double start = wall_time();
+    ScanState stats = {NULL, NULL, 0, 0};
+    MotifResult result = motif_finding_with_mismatches(sequences, num_sequences, l, d, alphabet, alphabet_size, num_threads, engine, &stats);
+    double end = wall_time();
 
-    printf("Motiv: %s\n", result.motif);
-    printf("Vreme: %lfs\n", (double)(end - start) / CLOCKS_PER_SEC);
+    for (int i = 0; i < result.count; i++) {
+        printf("Motiv: %s\n", result.motifs[i]);
+    }
+    if (stats.candidates > 0) {
+        printf("Prosecno prozora po kandidatu: %.2lf\n", (double)stats.windows / stats.candidates);
+    }
+    printf("Vreme: %lfs\n", end - start);
 
+    free_result(&result);
     for (int i = 0; i < num_sequences; i++) {
         free(sequences[i]);
     }
@@ -0,0 +1,264 @@
+#ifndef ILP_TABLE_H
+#define ILP_TABLE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#define ILP_MAGIC "PMS5ILP1"
+#define ILP_HEADER_SIZE 16
+
+/*
+    Answers of PMS5's ILP for every (n1, n2, n3, n4, n5, p1, p2, p3), n values up to l and p values up to d.
+    Binary file is the 8 byte magic, l and d as 32 bit ints and then one bit per cell in the order of ilp_index,
+    so it can be mapped as it is. Cells with n1 + ... + n5 > l are never asked for and stay false.
+ */
+typedef struct {
+    int l;
+    int d;
+    const uint8_t *bits;
+    uint8_t *owned;
+    void *mapping;
+    size_t mapping_size;
+} IlpTable;
+
+static inline size_t ilp_cells(int l, int d) {
+    size_t n = (size_t)(l + 1);
+    size_t p = (size_t)(d + 1);
+    return n * n * n * n * n * p * p * p;
+}
+
+static inline size_t ilp_index(int l, int d, int n1, int n2, int n3, int n4, int n5, int p1, int p2, int p3) {
+    size_t index = n1;
+    index = index * (l + 1) + n2;
+    index = index * (l + 1) + n3;
+    index = index * (l + 1) + n4;
+    index = index * (l + 1) + n5;
+    index = index * (d + 1) + p1;
+    index = index * (d + 1) + p2;
+    return index * (d + 1) + p3;
+}
+
+static inline bool ilp_lookup(const IlpTable *table, const int n[5], int p1, int p2, int p3) {
+    size_t index = ilp_index(table->l, table->d, n[0], n[1], n[2], n[3], n[4], p1, p2, p3);
+    return (table->bits[index >> 3] >> (index & 7)) & 1;
+}
+
+static inline void ilp_set(IlpTable *table, size_t index, bool value) {
+    if (value) {
+        table->owned[index >> 3] |= (uint8_t)(1 << (index & 7));
+    } else {
+        table->owned[index >> 3] &= (uint8_t)~(1 << (index & 7));
+    }
+}
+
+static inline IlpTable *create_ilp_table(int l, int d) {
+    /* Table in memory with every cell false, to be filled with ilp_set. */
+    IlpTable *table = (IlpTable *)malloc(sizeof(IlpTable));
+    table->l = l;
+    table->d = d;
+    table->owned = (uint8_t *)calloc((ilp_cells(l, d) + 7) / 8, 1);
+    table->bits = table->owned;
+    table->mapping = NULL;
+    table->mapping_size = 0;
+    return table;
+}
+
+static inline void free_ilp_table(IlpTable *table) {
+    if (table == NULL) {
+        return;
+    }
+    if (table->mapping != NULL) {
+        munmap(table->mapping, table->mapping_size);
+    }
+    free(table->owned);
+    free(table);
+}
+
+static inline bool write_ilp_table(const IlpTable *table, const char *filename) {
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        perror("Failed to open file");
+        return false;
+    }
+    int32_t header[2] = {table->l, table->d};
+    size_t bytes = (ilp_cells(table->l, table->d) + 7) / 8;
+    bool ok = fwrite(ILP_MAGIC, 1, 8, file) == 8 && fwrite(header, sizeof(int32_t), 2, file) == 2
+              && fwrite(table->bits, 1, bytes, file) == bytes;
+    return fclose(file) == 0 && ok;
+}
+
+static inline IlpTable *read_text_ilp_table(int l, int d, const char *filename) {
+    /*
+        Text table as the ILP solver script used to write them, one cell per line with 8 int numbers and one bool -> 3 2 0 0 1 2 2 1 true
+     */
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        perror("Failed to open file");
+        return NULL;
+    }
+    IlpTable *table = create_ilp_table(l, d);
+    int n1, n2, n3, n4, n5, p1, p2, p3;
+    char value[6];
+    while (fscanf(file, "%d %d %d %d %d %d %d %d %5s\n", &n1, &n2, &n3, &n4, &n5, &p1, &p2, &p3, value) == 9) {
+        if (n1 < 0 || n2 < 0 || n3 < 0 || n4 < 0 || n5 < 0 || n1 + n2 + n3 + n4 + n5 > l
+            || p1 < 0 || p2 < 0 || p3 < 0 || p1 > d || p2 > d || p3 > d) {
+            fprintf(stderr, "Tabela %s nije za l = %d i d = %d.\n", filename, l, d);
+            fclose(file);
+            free_ilp_table(table);
+            return NULL;
+        }
+        ilp_set(table, ilp_index(l, d, n1, n2, n3, n4, n5, p1, p2, p3), strcmp(value, "true") == 0);
+    }
+    fclose(file);
+    return table;
+}
+
+static inline IlpTable *load_ilp_table(int l, int d, const char *filename) {
+    /*
+        Binary tables are mapped read-only and used in place, so loading does not depend on the table size
+        and processes share the pages. Anything without the magic is read as a text table.
+     */
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open file");
+        return NULL;
+    }
+    char magic[8];
+    struct stat st;
+    if (read(fd, magic, 8) != 8 || memcmp(magic, ILP_MAGIC, 8) != 0 || fstat(fd, &st) != 0) {
+        close(fd);
+        return read_text_ilp_table(l, d, filename);
+    }
+
+    int32_t header[2];
+    size_t bytes = (ilp_cells(l, d) + 7) / 8;
+    if (read(fd, header, sizeof(header)) != sizeof(header) || header[0] != l || header[1] != d
+        || (size_t)st.st_size < ILP_HEADER_SIZE + bytes) {
+        fprintf(stderr, "Tabela %s nije za l = %d i d = %d.\n", filename, l, d);
+        close(fd);
+        return NULL;
+    }
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        perror("Failed to map file");
+        return NULL;
+    }
+
+    IlpTable *table = (IlpTable *)malloc(sizeof(IlpTable));
+    table->l = l;
+    table->d = d;
+    table->owned = NULL;
+    table->mapping = mapping;
+    table->mapping_size = st.st_size;
+    table->bits = (const uint8_t *)mapping + ILP_HEADER_SIZE;
+    return table;
+}
+
+static inline bool ilp_feasible(int n2, int n3, int n4, int n5, int p1, int p2, int p3) {
+    /*
+        PMS5's ILP only asks if the variables exist, and every variable only lowers the left sides,
+        so N1a = n1 and each group of variables uses up its n. What is left is how n2, n3 and n4 are split
+        between their two variables (i, j and k below) and how the 2 * n5 mismatches of the last group
+        are spread over the three constraints, at most n5 on each. The n1 does not matter at all.
+     */
+    for (int i = 0; i <= n2; i++) {
+        for (int j = 0; j <= n3; j++) {
+            for (int k = 0; k <= n4; k++) {
+                int s1 = p1 - ((n2 - i) + (n3 - j) + k);
+                int s2 = p2 - ((n2 - i) + j + (n4 - k));
+                int s3 = p3 - (i + (n3 - j) + (n4 - k));
+                if (s1 < 0 || s2 < 0 || s3 < 0) {
+                    continue;
+                }
+                if ((s1 < n5 ? s1 : n5) + (s2 < n5 ? s2 : n5) + (s3 < n5 ? s3 : n5) >= 2 * n5) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+typedef struct {
+    IlpTable *table;
+    size_t first_byte;
+    size_t last_byte;
+} IlpRange;
+
+static inline void *fill_ilp_range(void *arg) {
+    /* Each thread owns whole bytes of the bitset, so no two threads write the same byte. */
+    IlpRange *range = (IlpRange *)arg;
+    IlpTable *table = range->table;
+    int l = table->l;
+    int d = table->d;
+    size_t cells = ilp_cells(l, d);
+    for (size_t index = range->first_byte * 8; index < range->last_byte * 8 && index < cells; index++) {
+        size_t rest = index;
+        int p3 = rest % (d + 1); rest /= d + 1;
+        int p2 = rest % (d + 1); rest /= d + 1;
+        int p1 = rest % (d + 1); rest /= d + 1;
+        int n5 = rest % (l + 1); rest /= l + 1;
+        int n4 = rest % (l + 1); rest /= l + 1;
+        int n3 = rest % (l + 1); rest /= l + 1;
+        int n2 = rest % (l + 1); rest /= l + 1;
+        int n1 = rest;
+        if (n1 + n2 + n3 + n4 + n5 <= l && ilp_feasible(n2, n3, n4, n5, p1, p2, p3)) {
+            ilp_set(table, index, true);
+        }
+    }
+    return NULL;
+}
+
+static inline IlpTable *generate_ilp_table(int l, int d, int num_threads) {
+    /* Same answers as solving the ILP for every cell, cells split between num_threads threads. */
+    IlpTable *table = create_ilp_table(l, d);
+    size_t bytes = (ilp_cells(l, d) + 7) / 8;
+    IlpRange *ranges = (IlpRange *)malloc(num_threads * sizeof(IlpRange));
+    pthread_t *threads = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+    for (int t = 0; t < num_threads; t++) {
+        ranges[t] = (IlpRange){table, bytes * t / num_threads, bytes * (t + 1) / num_threads};
+        pthread_create(&threads[t], NULL, fill_ilp_range, &ranges[t]);
+    }
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+    free(ranges);
+    return table;
+}
+
+static inline IlpTable *open_ilp_table(int l, int d, const char *path, int num_threads) {
+    /*
+        Table for (l, d) from path. When path is a directory the table is its file ilr_<l>_<d>.bin.
+        If that file does not exist yet the table is generated and saved there, so the next run only maps it.
+     */
+    char filename[4096];
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        snprintf(filename, sizeof(filename), "%s/ilr_%d_%d.bin", path, l, d);
+    } else {
+        snprintf(filename, sizeof(filename), "%s", path);
+    }
+    if (access(filename, F_OK) == 0) {
+        return load_ilp_table(l, d, filename);
+    }
+
+    IlpTable *table = generate_ilp_table(l, d, num_threads);
+    if (write_ilp_table(table, filename)) {
+        printf("Tabela za l = %d i d = %d je generisana i sacuvana u %s\n", l, d, filename);
+    } else {
+        printf("Tabela za l = %d i d = %d je generisana, ali nije sacuvana.\n", l, d);
+    }
+    return table;
+}
+
+#endif
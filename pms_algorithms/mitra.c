@@ -3,220 +3,459 @@
 #include <string.h>
 #include <stdbool.h>
 #include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "neighbourhood.h"
+#include "task_queue.h"
 
 #define MAX_LINES 1000
 #define MAX_BUFFER 1200
-#define MAX_SEQ_LEN 650
 #define MAX_LINE_LENGTH 100
+#define TASKS_PER_THREAD 16
+
+/*
+    Windows are handled a block of bits at a time. Block is as wide as the widest vector unit the compiler
+    was allowed to use (-mavx2, SSE2 on every x86-64), and a single word otherwise.
+ */
+#if defined(__AVX2__)
+#define BLOCK_WORDS 4
+#elif defined(__SSE2__)
+#define BLOCK_WORDS 2
+#else
+#define BLOCK_WORDS 1
+#endif
+#define BLOCK_BITS (64 * BLOCK_WORDS)
+
+typedef uint64_t block_t __attribute__((vector_size(8 * BLOCK_WORDS)));
+
+typedef struct {
+    block_t *masks;
+    block_t *valid;
+    int *block_seq;
+    int num_blocks;
+    int alphabet_size;
+} WindowMasks;
+
+typedef struct {
+    int **blocks;
+    block_t **planes;
+    int *sizes;
+    int depth;
+    int num_planes;
+} MismatchStack;
+
+typedef struct {
+    char *motifs;
+    int length;
+    int count;
+    int capacity;
+} MotifList;
+
+typedef struct {
+    int *prefixes;
+    int capacity;
+    int split_depth;
+    TaskQueue queue;
+} TaskList;
+
+typedef struct {
+    TaskList *tasks;
+    WindowMasks *windows;
+    int l;
+    int d;
+    int num_sequences;
+    char *alphabet;
+    int alphabet_size;
+    MismatchStack stack;
+    MotifList found;
+    long long nodes;
+} Worker;
+
+
+void add_motif(MotifList *list, const char *motif) {
+    /* Motifs are stored one after another, each with its terminating zero. */
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? 2 * list->capacity : 64;
+        list->motifs = (char *)realloc(list->motifs, (size_t)list->capacity * (list->length + 1));
+        if (list->motifs == NULL) {
+            printf("Memory allocation failed add motif\n");
+            exit(1);
+        }
+    }
+    memcpy(&list->motifs[(size_t)list->count * (list->length + 1)], motif, list->length + 1);
+    list->count++;
+}
 
-typedef struct Dictionary{
-    int *table;
-    int size;
-    struct Dictionary* next;
-} Dictionary;
+char *motif_at(MotifList *list, int i) {
+    return &list->motifs[(size_t)i * (list->length + 1)];
+}
 
-typedef struct Node {
-    int id;
-    int distance;
-    char *motif;
-} Node;
+static inline bool block_any(block_t b) {
+    uint64_t any = 0;
+    for (int w = 0; w < BLOCK_WORDS; w++) {
+        any |= b[w];
+    }
+    return any != 0;
+}
 
+static inline void set_bit(block_t *blocks, int bit) {
+    blocks[bit / BLOCK_BITS][(bit % BLOCK_BITS) / 64] |= 1ULL << (bit % 64);
+}
 
-typedef struct MotifNode {
-    char *motif;
-    struct MotifNode *next;
-} MotifNode;
+block_t *alloc_blocks(size_t n) {
+    /* Vector loads need blocks aligned to their own size, which malloc does not promise for 256 bits. */
+    block_t *blocks = (block_t *)aligned_alloc(sizeof(block_t), (n > 0 ? n : 1) * sizeof(block_t));
+    memset(blocks, 0, (n > 0 ? n : 1) * sizeof(block_t));
+    return blocks;
+}
 
+block_t *window_mask(WindowMasks *windows, int depth, int c) {
+    return &windows->masks[((size_t)depth * windows->alphabet_size + c) * windows->num_blocks];
+}
 
-MotifNode* create_motif_node(const char *motif) {
-    MotifNode *new_node = (MotifNode *)malloc(sizeof(MotifNode));
-    if (new_node == NULL) {
-        printf("Memory allocation failed create node1\n");
-        exit(1);
+WindowMasks make_window_masks(char **sequences, int num_sequences, int l, char *alphabet, int alphabet_size) {
+    /*
+        Every window start gets one bit, each sequence starting on a new block so that a block belongs to one sequence.
+        Mask for depth p and character c has the bit of a window set when its character at position p is c.
+        Windows that do not fit in their sequence are left out of valid and never become alive.
+     */
+    WindowMasks windows;
+    windows.alphabet_size = alphabet_size;
+    windows.num_blocks = 0;
+    for (int j = 0; j < num_sequences; j++) {
+        windows.num_blocks += (strlen(sequences[j]) + BLOCK_BITS - 1) / BLOCK_BITS;
     }
-    new_node->motif = strdup(motif);
-    if (new_node->motif == NULL) {
-        printf("Memory allocation failed create node2\n");
-        free(new_node);
-        exit(1);
+    if (windows.num_blocks == 0) {
+        windows.num_blocks = 1;
     }
-    new_node->next = NULL;
-    return new_node;
-}
-
-void add_motif(MotifNode **head, const char *motif) {
-    MotifNode *new_node = create_motif_node(motif);
-    new_node->next = *head;
-    *head = new_node;
+    windows.masks = alloc_blocks((size_t)l * alphabet_size * windows.num_blocks);
+    windows.valid = alloc_blocks(windows.num_blocks);
+    windows.block_seq = (int *)calloc(windows.num_blocks, sizeof(int));
+
+    int codes[256];
+    build_symbol_codes(alphabet, alphabet_size, codes);
+
+    int first_block = 0;
+    for (int j = 0; j < num_sequences; j++) {
+        int s_len = strlen(sequences[j]);
+        int seq_blocks = (s_len + BLOCK_BITS - 1) / BLOCK_BITS;
+        for (int b = 0; b < seq_blocks; b++) {
+            windows.block_seq[first_block + b] = j;
+        }
+        for (int k = 0; k + l <= s_len; k++) {
+            int bit = first_block * BLOCK_BITS + k;
+            set_bit(windows.valid, bit);
+            for (int p = 0; p < l; p++) {
+                int c = codes[(unsigned char)sequences[j][k + p]];
+                if (c >= 0) {
+                    set_bit(window_mask(&windows, p, c), bit);
+                }
+            }
+        }
+        first_block += seq_blocks;
+    }
+    return windows;
 }
 
-void free_motifs(MotifNode *head) {
-    MotifNode *current = head;
-    while (current != NULL) {
-        MotifNode *next = current->next;
-        free(current->motif);
-        free(current);
-        current = next;
+int winnow_windows(WindowMasks *windows, char **sequences, int num_sequences, int l, int d, char *alphabet, int alphabet_size) {
+    /*
+        WINNOWER style pre-pass. An occurrence of the motif has an occurrence in every other sequence within d
+        of the motif, so within 2d of itself. A window without such a partner in some other sequence can not be
+        an occurrence and is taken out of valid. Removed windows no longer count as partners, so this repeats
+        until nothing changes. Windows are compared packed, a character outside the alphabet differs from
+        every motif character, so it is counted as a mismatch on both sides and 2d still bounds the distance.
+        Returns the number of removed windows.
+     */
+    int codes[256];
+    build_symbol_codes(alphabet, alphabet_size, codes);
+    kmer_t **packed = (kmer_t **)malloc(num_sequences * sizeof(kmer_t *));
+    kmer_t **bad = (kmer_t **)malloc(num_sequences * sizeof(kmer_t *));
+    bool **alive = (bool **)malloc(num_sequences * sizeof(bool *));
+    int *counts = (int *)malloc(num_sequences * sizeof(int));
+    int *first_block = (int *)malloc(num_sequences * sizeof(int));
+    int block = 0;
+    for (int j = 0; j < num_sequences; j++) {
+        int s_len = strlen(sequences[j]);
+        counts[j] = s_len >= l ? s_len - l + 1 : 0;
+        packed[j] = (kmer_t *)malloc((counts[j] + 1) * sizeof(kmer_t));
+        bad[j] = (kmer_t *)malloc((counts[j] + 1) * sizeof(kmer_t));
+        alive[j] = (bool *)malloc((counts[j] + 1) * sizeof(bool));
+        for (int k = 0; k < counts[j]; k++) {
+            packed[j][k] = pack_kmer(&sequences[j][k], l, codes, &bad[j][k]);
+            alive[j][k] = true;
+        }
+        first_block[j] = block;
+        block += (s_len + BLOCK_BITS - 1) / BLOCK_BITS;
     }
-}
 
-Dictionary *make_index_list(char **seq, int num_sequences, int l) {
-    int total_length = MAX_SEQ_LEN*num_sequences;
-    Dictionary *ind_dict = (Dictionary*)malloc(sizeof(Dictionary));
-    ind_dict->table = (int *)calloc(total_length, sizeof(int));
+    int removed = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int j = 0; j < num_sequences; j++) {
+            for (int k = 0; k < counts[j]; k++) {
+                if (!alive[j][k]) {
+                    continue;
+                }
+                for (int other = 0; other < num_sequences && alive[j][k]; other++) {
+                    if (other == j) {
+                        continue;
+                    }
+                    bool partner = false;
+                    for (int m = 0; m < counts[other] && !partner; m++) {
+                        partner = alive[other][m] && packed_distance(packed[j][k], packed[other][m], bad[j][k] | bad[other][m]) <= 2 * d;
+                    }
+                    if (!partner) {
+                        alive[j][k] = false;
+                        int bit = first_block[j] * BLOCK_BITS + k;
+                        windows->valid[bit / BLOCK_BITS][(bit % BLOCK_BITS) / 64] &= ~(1ULL << (bit % 64));
+                        removed++;
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
 
-    if (ind_dict->table == NULL) {
-        printf("Memory allocation failed make index list\n");
-        exit(1);
+    for (int j = 0; j < num_sequences; j++) {
+        free(packed[j]);
+        free(bad[j]);
+        free(alive[j]);
     }
-    ind_dict->size = total_length;
-    ind_dict->next = NULL;
+    free(packed);
+    free(bad);
+    free(alive);
+    free(counts);
+    free(first_block);
+    return removed;
+}
 
-    return ind_dict;
+void free_window_masks(WindowMasks *windows) {
+    free(windows->masks);
+    free(windows->valid);
+    free(windows->block_seq);
 }
 
-Node* make_node(int distance, char *motif) {
-    Node *node = (Node *)malloc(sizeof(Node));
-    if (node == NULL) {
-        printf("Memory allocation failed make node1\n");
-        exit(1);
+MismatchStack create_mismatch_stack(WindowMasks *windows, int l, int d) {
+    /*
+        Level p lists the blocks that still have a window within d of the current motif of length p.
+        Mismatch counters are bit-sliced by value: for each listed block there are d + 1 planes, plane j
+        has the windows with exactly j mismatches. Levels are allocated once and reused by every node at that depth.
+     */
+    MismatchStack stack;
+    stack.depth = l + 1;
+    stack.num_planes = d + 1;
+    stack.blocks = (int **)malloc(stack.depth * sizeof(int *));
+    stack.planes = (block_t **)malloc(stack.depth * sizeof(block_t *));
+    stack.sizes = (int *)calloc(stack.depth, sizeof(int));
+    for (int p = 0; p < stack.depth; p++) {
+        stack.blocks[p] = (int *)malloc(windows->num_blocks * sizeof(int));
+        stack.planes[p] = alloc_blocks((size_t)windows->num_blocks * stack.num_planes);
     }
-    node->distance = distance;
-    node->motif = strdup(motif);
-    if (node->motif == NULL) {
-        printf("Memory allocation failed make node2\n");
-        free(node);
-        exit(1);
+    for (int b = 0; b < windows->num_blocks; b++) {
+        if (block_any(windows->valid[b])) {
+            int t = stack.sizes[0]++;
+            stack.blocks[0][t] = b;
+            stack.planes[0][(size_t)t * stack.num_planes] = windows->valid[b];
+        }
     }
-    return node;
+    return stack;
 }
 
+void free_mismatch_stack(MismatchStack *stack) {
+    for (int p = 0; p < stack->depth; p++) {
+        free(stack->blocks[p]);
+        free(stack->planes[p]);
+    }
+    free(stack->blocks);
+    free(stack->planes);
+    free(stack->sizes);
+}
 
-Node *get_next_node(Node *node, int position, int l, char **sequences, int seq_len, char *motif, char e) {
+bool extend_level(MismatchStack *stack, WindowMasks *windows, int depth, int c, int num_sequences) {
     /*
-        Creating child node from parent by concatening char e to motif.
-        Each lmer in input sequences has unique position (sequence index and position in t) so the lmers are saved with those
-        two number instead of whole strings.
-    */
-
-    size_t new_len = strlen(motif) + 2;
-    char *new_motif = (char *)malloc(new_len);
-    if (new_motif == NULL) {
-        printf("Memory allocation failed get next 2\n");
-        exit(1);
-    }
-    strncpy(new_motif, motif, strlen(motif));
-    new_motif[strlen(motif)] = e;
-    new_motif[strlen(motif) + 1] = '\0';
-
-    Node *next_node = make_node(node->distance + 1, new_motif);
-    return next_node;
+        Alive windows of level depth are extended by character c into level depth + 1. For a block of windows,
+        the ones whose character at this depth matches keep their count and the others move one plane up,
+        the windows on plane d fall off. Blocks are listed by sequence, so this stops as soon as it passes
+        a sequence without an alive window. Returns whether every sequence still has one.
+     */
+    int num_planes = stack->num_planes;
+    const int *blocks = stack->blocks[depth];
+    const block_t *planes = stack->planes[depth];
+    int *next_blocks = stack->blocks[depth + 1];
+    block_t *next_planes = stack->planes[depth + 1];
+    const block_t *mask = window_mask(windows, depth, c);
+    int size = 0;
+    int covered = 0;
+    for (int t = 0; t < stack->sizes[depth]; t++) {
+        int seq = windows->block_seq[blocks[t]];
+        if (seq > covered) {
+            break;
+        }
+        const block_t *plane = &planes[(size_t)t * num_planes];
+        block_t *next_plane = &next_planes[(size_t)size * num_planes];
+        block_t match = mask[blocks[t]];
+        block_t alive = next_plane[0] = plane[0] & match;
+        for (int j = 1; j < num_planes; j++) {
+            next_plane[j] = (plane[j] & match) | (plane[j - 1] & ~match);
+            alive |= next_plane[j];
+        }
+        if (block_any(alive)) {
+            next_blocks[size++] = blocks[t];
+            covered = seq + 1;
+        }
+    }
+    stack->sizes[depth + 1] = size;
+    return covered == num_sequences;
 }
 
-int hamming_distance(char *str1, char *str2) {
-    int count = 0;
-    for (int i = 0; i < strlen(str1); i++) {
-        if (str1[i] != str2[i]) {
-            count++;
+void virtual_dfs(char *motif, int depth, Worker *worker) {
+    /*
+        Motif of length depth is extended by each character and the search goes on below every extension
+        that some window of each sequence still supports. Every motif that reaches length l has a window
+        within d in each sequence, so the leaves are exactly the motifs, found in alphabet order.
+     */
+    worker->nodes++;
+    if (depth == worker->l) {
+        motif[depth] = '\0';
+        add_motif(&worker->found, motif);
+        return;
+    }
+    for (int i = 0; i < worker->alphabet_size; i++) {
+        if (extend_level(&worker->stack, worker->windows, depth, i, worker->num_sequences)) {
+            motif[depth] = worker->alphabet[i];
+            virtual_dfs(motif, depth + 1, worker);
         }
     }
-    return count;
 }
 
-
-void virtual_dfs(Node *start, Dictionary *tables, int l, char **sequences, int num_sequences, int k, int d, MotifNode **motifs, char* alphabet, int alphabet_size) {
-    if (start->distance == l) {
-        add_motif(motifs, start->motif);
+void collect_prefixes(int *prefix, int depth, MismatchStack *stack, WindowMasks *windows, int num_sequences, int alphabet_size, TaskList *tasks, long long *nodes) {
+    /* Top of the tree down to split_depth is walked once, every prefix that survives it becomes a task. */
+    if (depth == tasks->split_depth) {
+        if (tasks->queue.count == tasks->capacity) {
+            tasks->capacity = tasks->capacity ? 2 * tasks->capacity : 64;
+            tasks->prefixes = (int *)realloc(tasks->prefixes, ((size_t)tasks->capacity * depth + 1) * sizeof(int));
+        }
+        memcpy(&tasks->prefixes[(size_t)tasks->queue.count * tasks->split_depth], prefix, depth * sizeof(int));
+        tasks->queue.count++;
         return;
     }
-
+    (*nodes)++;
     for (int i = 0; i < alphabet_size; i++) {
-
-        Node *next_node = get_next_node(start, start->distance, l, sequences, num_sequences, start->motif, alphabet[i]);
-
-        Dictionary *updated_table = (Dictionary*)malloc(sizeof(Dictionary));
-        updated_table->table = (int *)malloc(MAX_SEQ_LEN*num_sequences*sizeof(int));
-        memcpy(updated_table->table, tables->table, tables->size * sizeof(int));
-        updated_table->size = tables->size;
-        updated_table->next = NULL;
-        int count = 0;
-
-        for (int j = 0; j < updated_table->size; j++) {
-            int whole = j / MAX_SEQ_LEN;
-            int rem = j - MAX_SEQ_LEN * whole;
-            char *lmer = (char *) malloc((l+1) * sizeof(char));
-            int len_sq = strlen(sequences[whole]);
-            if (rem > len_sq - l + 1){
-                j += MAX_SEQ_LEN - rem - 1;
-                free(lmer);
-                continue;
-            }
-            strncpy(lmer, &sequences[whole][rem], l);
-            lmer[l] = '\0';
-            if (lmer[start->distance] != alphabet[i]) {
-                int tree = updated_table->table[j];
-                updated_table->table[j]++;
-            }
-            if (updated_table->table[j] <= d) {
-                count++;
-            }
-            free(lmer);
+        if (extend_level(stack, windows, depth, i, num_sequences)) {
+            prefix[depth] = i;
+            collect_prefixes(prefix, depth + 1, stack, windows, num_sequences, alphabet_size, tasks, nodes);
         }
+    }
+}
 
-        if (count >= k) {
-            virtual_dfs(next_node, updated_table, l, sequences, num_sequences, k, d, motifs, alphabet, alphabet_size);
+void *run_worker(void *arg) {
+    /*
+        Tasks are handed out in increasing order from a shared counter, so a worker that got a cheap subtree
+        simply takes the next one. Each worker replays its prefix in its own stack and searches below it,
+        so its motifs come out in alphabet order.
+     */
+    Worker *worker = (Worker *)arg;
+    TaskList *tasks = worker->tasks;
+    char motif[worker->l + 1];
+    int task;
+    while (next_task(&tasks->queue, &task)) {
+        const int *prefix = &tasks->prefixes[(size_t)task * tasks->split_depth];
+        for (int p = 0; p < tasks->split_depth; p++) {
+            extend_level(&worker->stack, worker->windows, p, prefix[p], worker->num_sequences);
+            motif[p] = worker->alphabet[prefix[p]];
         }
+        virtual_dfs(motif, tasks->split_depth, worker);
+    }
+    return NULL;
+}
 
-        free(updated_table->table);
-        free(updated_table);
-        free(next_node->motif);
-        free(next_node);
+int compare_motifs(const char *x, const char *y, const int *rank) {
+    for (; *x; x++, y++) {
+        if (*x != *y) {
+            return rank[(unsigned char)*x] - rank[(unsigned char)*y];
+        }
     }
+    return 0;
 }
 
-void filter_motifs(MotifNode **motifs, char **sequences, int num_sequences, int l, int d) {
-    /* Go through all possible motifs and filter ones that don't have neighbours in each input sequences. */
-    MotifNode* motif_list = (*motifs);
-    while (motif_list) {
-        int matches = 0;
-        for (int j = 0; j < num_sequences; j++) {
-            int s_len = strlen(sequences[j]);
-            for (int k = 0; k < s_len - l + 1; k++) {
-                char* current_substring = (char *) malloc((l+1)*sizeof(char));
-                strncpy(current_substring, &sequences[j][k], l);
-                current_substring[l] = '\0';
-
-                int distance = hamming_distance(motif_list->motif, current_substring);
-                if (distance <= d) {
-                    matches++;
-                    break;
-                }
-            }
+void find_motifs(int l, int d, char **sequences, int num_sequences, char*alphabet, int alphabet_size, int num_threads, int split_depth, bool winnow) {
+    /* 
+        Walk the mismatch tree from the empty motif, keeping the alive windows of every level in a stack of bitsets.
+        Subtrees below split_depth are searched by num_threads workers, each with its own stack and motifs.
+        Workers' motifs are each in alphabet order and are merged into one ordered list.
+        With winnow, windows that can not be occurrences are removed before the search starts.
+     */
+    WindowMasks windows = make_window_masks(sequences, num_sequences, l, alphabet, alphabet_size);
+    if (winnow) {
+        if (alphabet_size <= 4 && l <= MAX_PACKED_LEN) {
+            printf("Uklonjeno prozora: %d\n", winnow_windows(&windows, sequences, num_sequences, l, d, alphabet, alphabet_size));
+        } else {
+            printf("Predobrada se preskace, l-meri se ne mogu spakovati u 2 bita po karakteru.\n");
+        }
+    }
+    if (split_depth < 0) {
+        split_depth = 0;
+        for (long long subtrees = 1; split_depth < l && subtrees < (long long)num_threads * TASKS_PER_THREAD; subtrees *= alphabet_size) {
+            split_depth++;
         }
+        if (num_threads == 1) {
+            split_depth = 0;
+        }
+    }
+    if (split_depth > l) {
+        split_depth = l;
+    }
 
-        if (matches == num_sequences) {
-            printf("Motiv: %s\n", motif_list->motif);
+    long long nodes = 0;
+    TaskList tasks = {NULL, 0, split_depth, {0, 0}};
+    MismatchStack top = create_mismatch_stack(&windows, l, d);
+    int prefix[l + 1];
+    collect_prefixes(prefix, 0, &top, &windows, num_sequences, alphabet_size, &tasks, &nodes);
+    free_mismatch_stack(&top);
+
+    Worker *workers = (Worker *)malloc(num_threads * sizeof(Worker));
+    for (int t = 0; t < num_threads; t++) {
+        workers[t] = (Worker){&tasks, &windows, l, d, num_sequences, alphabet, alphabet_size, create_mismatch_stack(&windows, l, d), {NULL, l, 0, 0}, 0};
+    }
+    run_workers(run_worker, workers, sizeof(Worker), num_threads);
+
+    int rank[256] = {0};
+    for (int a = 0; a < alphabet_size; a++) {
+        rank[(unsigned char)alphabet[a]] = a;
+    }
+    int *next = (int *)calloc(num_threads, sizeof(int));
+    while (true) {
+        int best = -1;
+        for (int t = 0; t < num_threads; t++) {
+            if (next[t] < workers[t].found.count && (best < 0 || compare_motifs(motif_at(&workers[t].found, next[t]), motif_at(&workers[best].found, next[best]), rank) < 0)) {
+                best = t;
+            }
         }
-        motif_list = motif_list->next;
+        if (best < 0) {
+            break;
+        }
+        printf("Motiv: %s\n", motif_at(&workers[best].found, next[best]++));
+    }
+    for (int t = 0; t < num_threads; t++) {
+        nodes += workers[t].nodes;
     }
+    printf("Posecenih cvorova: %lld\n", nodes);
 
+    for (int t = 0; t < num_threads; t++) {
+        free(workers[t].found.motifs);
+        free_mismatch_stack(&workers[t].stack);
+    }
+    free(next);
+    free(workers);
+    free(tasks.prefixes);
+    free_window_masks(&windows);
 }
 
-void find_motifs(int l, int d, char **sequences, int num_sequences, char*alphabet, int alphabet_size) {
-    /* 
-        Create root node from which will traveling begun.
-        Perform DFS and filter motifs.
-     */
-    Node *root_node = make_node(0, "");
-    Dictionary *list_tables = make_index_list(sequences, num_sequences, l);
-
-    list_tables->next = NULL;
-    MotifNode *motifs = NULL;
-    
-    virtual_dfs(root_node, list_tables, l, sequences, num_sequences, num_sequences, d, &motifs, alphabet, alphabet_size);
-    filter_motifs(&motifs, sequences, num_sequences, l, d);
-    
-    free_motifs(motifs);
+double wall_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
 
@@ -263,40 +502,63 @@ char* read_alphabet(const char *file_name, int *num_chars) {
 
 int main(int argc, char *argv[]) {
 
-    if (argc < 4) {
-        fprintf(stderr, "Argumenti: <duzina_motiva> <broj_mutacija> <datoteka_sa_sekvencama> [<datoteka_sa_azbukom>]\n");
+    /* Options may appear anywhere, what is left are positional arguments. */
+    int num_threads = 1;
+    int split_depth = -1;
+    bool winnow = false;
+    char *args[5];
+    int num_args = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            num_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--split-depth") == 0 && i + 1 < argc) {
+            split_depth = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--winnow") == 0) {
+            winnow = true;
+        } else if (num_args < 5) {
+            args[num_args++] = argv[i];
+        }
+    }
+
+    if (num_args < 4) {
+        fprintf(stderr, "Argumenti: <duzina_motiva> <broj_mutacija> <datoteka_sa_sekvencama> [<datoteka_sa_azbukom>] [--threads <broj_niti>] [--split-depth <dubina>] [--winnow]\n");
         return 1;
     }
 
-    int l = atoi(argv[1]);
-    int d = atoi(argv[2]);
+    int l = atoi(args[1]);
+    int d = atoi(args[2]);
 
     if (l<0 || d<0){
         fprintf(stderr, "Argumenti duzina motiva i dozvoljene mutacije moraju biti veci od 0.\n");
         return 1;
     }
+    if (num_threads < 1) {
+        fprintf(stderr, "Broj niti mora biti veci od 0.\n");
+        return 1;
+    }
     int num_sequences;
-    char **sequences = read_lines_from_file(argv[3], &num_sequences);
+    char **sequences = read_lines_from_file(args[3], &num_sequences);
 
-    char *alphabet = (char *)malloc(25*sizeof(char));
+    char *alphabet;
     int alphabet_size;
 
-    if (argc == 5) {
-        alphabet = read_alphabet(argv[4], &alphabet_size);
+    if (num_args == 5) {
+        alphabet = read_alphabet(args[4], &alphabet_size);
     } else{
         alphabet = strdup("acgt");
         alphabet_size = 4;
     }
 
-    clock_t start = clock();
-    find_motifs(l, d, sequences, num_sequences, alphabet, alphabet_size);
-    clock_t end = clock();
+    double start = wall_time();
+    find_motifs(l, d, sequences, num_sequences, alphabet, alphabet_size, num_threads, split_depth, winnow);
+    double end = wall_time();
 
-    printf("Vreme: %lfs\n", (double)(end - start) / CLOCKS_PER_SEC);
+    printf("Vreme: %lfs\n", end - start);
 
     for (int i = 0; i < num_sequences; i++) {
         free(sequences[i]);
     }
     free(sequences);
+    free(alphabet);
     return 0;
 }
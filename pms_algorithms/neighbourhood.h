@@ -0,0 +1,128 @@
+#ifndef NEIGHBOURHOOD_H
+#define NEIGHBOURHOOD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MAX_PACKED_LEN 32
+
+/*
+    L-mers are packed 2 bits per character, first character in the highest bits,
+    so comparing packed values gives the same order as comparing strings.
+    Works for alphabets of at most 4 characters and l-mers of at most MAX_PACKED_LEN characters.
+ */
+typedef uint64_t kmer_t;
+
+/* Called once for every neighbour. */
+typedef void (*neighbour_fn)(kmer_t neighbour, void *ctx);
+
+/* Other characters of a position in reflected Gray code order, each step flips a single bit. */
+static const kmer_t gray_masks[3] = {1, 3, 2};
+
+/* Low bit of every packed position. */
+#define LOW_BITS 0x5555555555555555ULL
+
+static inline void build_symbol_codes(const char *alphabet, int alphabet_size, int codes[256]) {
+    /* Characters outside of the alphabet get -1. */
+    for (int c = 0; c < 256; c++) {
+        codes[c] = -1;
+    }
+    for (int a = 0; a < alphabet_size; a++) {
+        codes[(unsigned char)alphabet[a]] = a;
+    }
+}
+
+static inline kmer_t pack_kmer(const char *kmer, int length, const int codes[256], kmer_t *bad) {
+    /*
+        Characters outside of the alphabet are packed as 0 and get the low bit of their position set in bad,
+        so a window with bad != 0 is not an l-mer over the alphabet.
+     */
+    kmer_t code = 0;
+    *bad = 0;
+    for (int p = 0; p < length; p++) {
+        int c = codes[(unsigned char)kmer[p]];
+        code <<= 2;
+        *bad <<= 2;
+        if (c < 0) {
+            *bad |= 1;
+        } else {
+            code |= (kmer_t)c;
+        }
+    }
+    return code;
+}
+
+static inline void unpack_kmer(kmer_t code, int length, const char *alphabet, char *out) {
+    for (int p = length - 1; p >= 0; p--) {
+        out[p] = alphabet[code & 3];
+        code >>= 2;
+    }
+    out[length] = '\0';
+}
+
+static inline int packed_distance(kmer_t x, kmer_t y, kmer_t bad) {
+    /*
+        Hamming distance of two packed l-mers, a character differs when either of its two bits does.
+        Positions set in bad (the bad masks of both l-mers ORed) always count as a mismatch.
+     */
+    kmer_t diff = x ^ y;
+    return __builtin_popcountll(((diff | (diff >> 1)) & LOW_BITS) | bad);
+}
+
+static void visit_neighbours(kmer_t code, kmer_t fixed, int position, int depth, int l, int d, int alphabet_size, neighbour_fn fn, void *ctx) {
+    /*
+        DFS that changes positions in increasing order, so every neighbour is reached exactly once.
+        Positions set in fixed are never changed. Nothing is allocated, the only state is the recursion which is at most d deep.
+     */
+    fn(code, ctx);
+    if (depth == d) {
+        return;
+    }
+    for (int p = position; p < l; p++) {
+        int shift = 2 * (l - 1 - p);
+        if ((fixed >> shift) & 1) {
+            continue;
+        }
+        if (alphabet_size == 4) {
+            for (int g = 0; g < 3; g++) {
+                visit_neighbours(code ^ (gray_masks[g] << shift), fixed, p + 1, depth + 1, l, d, alphabet_size, fn, ctx);
+            }
+        } else {
+            kmer_t own = (code >> shift) & 3;
+            kmer_t cleared = code & ~((kmer_t)3 << shift);
+            for (kmer_t a = 0; a < (kmer_t)alphabet_size; a++) {
+                if (a != own) {
+                    visit_neighbours(cleared | (a << shift), fixed, p + 1, depth + 1, l, d, alphabet_size, fn, ctx);
+                }
+            }
+        }
+    }
+}
+
+static void fill_bad_positions(kmer_t code, kmer_t bad, kmer_t left, int l, int d, int alphabet_size, neighbour_fn fn, void *ctx) {
+    /* Tries every character at each position left in the bad mask, then visits the neighbours of the filled l-mer. */
+    if (left == 0) {
+        int mismatches = __builtin_popcountll(bad);
+        visit_neighbours(code, bad, 0, mismatches, l, d, alphabet_size, fn, ctx);
+        return;
+    }
+    int shift = __builtin_ctzll(left);
+    for (kmer_t a = 0; a < (kmer_t)alphabet_size; a++) {
+        fill_bad_positions(code | (a << shift), bad, left & (left - 1), l, d, alphabet_size, fn, ctx);
+    }
+}
+
+static inline void for_each_neighbour(kmer_t code, kmer_t bad, int l, int d, int alphabet_size, neighbour_fn fn, void *ctx) {
+    /*
+        Visits every l-mer within Hamming distance d of code, code itself first. Positions set in bad (see pack_kmer)
+        hold a character outside of the alphabet, so every l-mer differs there: each of them is filled with every
+        character at the cost of one mismatch and only the rest of d is spent on the other positions.
+     */
+    if (bad == 0) {
+        visit_neighbours(code, 0, 0, 0, l, d, alphabet_size, fn, ctx);
+    } else if (__builtin_popcountll(bad) <= d) {
+        fill_bad_positions(code, bad, bad, l, d, alphabet_size, fn, ctx);
+    }
+}
+
+#endif
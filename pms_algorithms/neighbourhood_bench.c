@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "neighbourhood.h"
+
+#define MIN_BENCH_TIME 1.0
+
+typedef struct {
+    long long count;
+    kmer_t checksum;
+} BenchContext;
+
+void count_neighbour(kmer_t neighbour, void *ctx) {
+    BenchContext *context = (BenchContext *)ctx;
+    context->count++;
+    context->checksum ^= neighbour;
+}
+
+double wall_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void bench(int l, int d) {
+    /* Enumerate neighbourhoods of random l-mers until MIN_BENCH_TIME passes. */
+    BenchContext context = {0, 0};
+    kmer_t mask = (l == MAX_PACKED_LEN) ? ~(kmer_t)0 : (((kmer_t)1 << (2 * l)) - 1);
+    long long lmers = 0;
+    double start = wall_time();
+    double elapsed = 0;
+    while (elapsed < MIN_BENCH_TIME) {
+        kmer_t lmer = (((kmer_t)rand() << 31) ^ (kmer_t)rand()) & mask;
+        for_each_neighbour(lmer, 0, l, d, 4, count_neighbour, &context);
+        lmers++;
+        elapsed = wall_time() - start;
+    }
+    printf("(%d,%d): %lld suseda po l-meru, %.1f miliona suseda u sekundi (kontrolna suma %llx)\n",
+           l, d, context.count / lmers, context.count / elapsed / 1e6, (unsigned long long)context.checksum);
+}
+
+int main() {
+    srand(1);
+    bench(11, 2);
+    bench(13, 3);
+    bench(15, 4);
+    return 0;
+}
@@ -3,10 +3,12 @@
 #include <string.h>
 #include <stdbool.h>
 #include <time.h>
+#include "neighbourhood.h"
+#include "ilp_table.h"
+#include "task_queue.h"
 
 #define MAX_LEN 20
 #define MAX_VISITED 100000
-#define MAX_Q_SIZE 1000000
 #define Q_TRESHOLD 8000
 #define MAX_LINES 1000
 #define MAX_BUFFER 1200
@@ -15,81 +17,118 @@
 #define MAX_LINE_LENGTH 100
 
 
-typedef struct Node {
-    int position;
-    char value[MAX_LEN];
-    struct Node** children;
-    int num_children;
-    int depth;
-} Node;
-
-typedef struct Queue {
-    Node** items;
-    int front;
-    int rear;
-    int size;
-    int capacity;
-} Queue;
-
+/*
+    Set of packed l-mers. items[0..sorted) are sorted without duplicates, items added after that wait
+    at the end until normalize_set sorts them and merges them in, so adding is a plain append.
+ */
 typedef struct Set {
-    char** items;
+    kmer_t* items;
     int size;
+    int sorted;
     int capacity;
 } Set;
 
 Set* create_set(int capacity) {
     Set* set = (Set*)malloc(sizeof(Set));
-    set->items = (char**)malloc(capacity * sizeof(char*));
+    set->items = (kmer_t*)malloc(capacity * sizeof(kmer_t));
     set->size = 0;
+    set->sorted = 0;
     set->capacity = capacity;
     return set;
 }
 
-void add_to_set(Set* set, const char* item) {
-    if (set->size == set->capacity) {
-        set->capacity *= 2;
-        set->items = (char**)realloc(set->items, set->capacity * sizeof(char*));
-    }
-    set->items[set->size] = strdup(item);
-    set->size++;
+int compare_kmers(const void *a, const void *b) {
+    kmer_t x = *(const kmer_t *)a;
+    kmer_t y = *(const kmer_t *)b;
+    return (x > y) - (x < y);
 }
 
-bool set_contains(Set* set, const char* item) {
-    for (int i = 0; i < set->size; i++) {
-        if (strcmp(set->items[i], item) == 0) {
-            return true;
+void normalize_set(Set* set) {
+    /* Sort and deduplicate the waiting items, then merge them into the sorted part from the back. */
+    int waiting = set->size - set->sorted;
+    if (waiting == 0) {
+        return;
+    }
+    kmer_t *tail = (kmer_t*)malloc(waiting * sizeof(kmer_t));
+    memcpy(tail, set->items + set->sorted, waiting * sizeof(kmer_t));
+    qsort(tail, waiting, sizeof(kmer_t), compare_kmers);
+    int unique = 1;
+    for (int i = 1; i < waiting; i++) {
+        if (tail[i] != tail[unique - 1]) {
+            tail[unique++] = tail[i];
         }
     }
-    return false;
+
+    int i = set->sorted - 1, j = unique - 1, w = set->sorted + unique - 1;
+    while (j >= 0) {
+        if (i >= 0 && set->items[i] > tail[j]) {
+            set->items[w--] = set->items[i--];
+        } else {
+            set->items[w--] = tail[j--];
+        }
+    }
+    free(tail);
+
+    int size = set->sorted + unique;
+    int kept = size > 0 ? 1 : 0;
+    for (int k = 1; k < size; k++) {
+        if (set->items[k] != set->items[kept - 1]) {
+            set->items[kept++] = set->items[k];
+        }
+    }
+    set->size = set->sorted = kept;
 }
 
-Set* set_union(Set* set1, Set* set2) {
-    Set* result = create_set(set1->size + set2->size);
-    for (int i = 0; i < set1->size; i++) {
-        add_to_set(result, set1->items[i]);
+void add_to_set(Set* set, kmer_t item) {
+    if (set->size == set->capacity) {
+        normalize_set(set);
+        if (set->size * 2 > set->capacity) {
+            set->capacity *= 2;
+            set->items = (kmer_t*)realloc(set->items, set->capacity * sizeof(kmer_t));
+        }
     }
+    set->items[set->size++] = item;
+}
+
+bool set_contains(Set* set, kmer_t item) {
+    normalize_set(set);
+    return bsearch(&item, set->items, set->size, sizeof(kmer_t), compare_kmers) != NULL;
+}
+
+void set_union(Set* set1, Set* set2) {
+    /* Union stored in set1. */
+    normalize_set(set2);
     for (int i = 0; i < set2->size; i++) {
-        if (!set_contains(result, set2->items[i])) {
-            add_to_set(result, set2->items[i]);
-        }
+        add_to_set(set1, set2->items[i]);
     }
-    return result;
+    normalize_set(set1);
 }
 
-Set* set_intersection(Set* set1, Set* set2) {
-    Set* result = create_set(set1->size);
-    for (int i = 0; i < set1->size; i++) {
-        if (set_contains(set2, set1->items[i])) {
-            add_to_set(result, set1->items[i]);
+void set_intersection(Set* set1, Set* set2) {
+    /* Intersection stored in set1, one merge-like pass over both sorted sets. */
+    normalize_set(set1);
+    normalize_set(set2);
+    int kept = 0;
+    for (int i = 0, j = 0; i < set1->size && j < set2->size;) {
+        if (set1->items[i] < set2->items[j]) {
+            i++;
+        } else if (set1->items[i] > set2->items[j]) {
+            j++;
+        } else {
+            set1->items[kept++] = set1->items[i];
+            i++;
+            j++;
         }
     }
-    return result;
+    set1->size = set1->sorted = kept;
+}
+
+void clear_set(Set* set) {
+    set->size = 0;
+    set->sorted = 0;
 }
 
 void free_set(Set* set) {
-    for (int i = 0; i < set->size; i++) {
-        free(set->items[i]);
-    }
     free(set->items);
     free(set);
 }
@@ -105,58 +144,6 @@ char* slice(char *sequence, int start, int length) {
     return substring;
 }
 
-Queue* createQueue(int capacity) {
-    Queue* queue = (Queue*)malloc(sizeof(Queue));
-    queue->capacity = capacity;
-    queue->front = queue->size = 0;
-    queue->rear = capacity - 1;
-    queue->items = (Node**)malloc(queue->capacity * sizeof(Node*));
-    return queue;
-}
-
-bool isQueueFull(Queue* queue) {
-    return (queue->size == queue->capacity);
-}
-
-bool isQueueEmpty(Queue* queue) {
-    return (queue->size == 0);
-}
-
-void enqueue(Queue* queue, Node* item) {
-    if (isQueueFull(queue)) {
-        return;
-    }
-    queue->rear = (queue->rear + 1) % queue->capacity;
-    queue->items[queue->rear] = item;
-    queue->size = queue->size + 1;
-}
-
-Node* dequeue(Queue* queue) {
-    if (isQueueEmpty(queue)) {
-        return NULL;
-    }
-    Node* item = queue->items[queue->front];
-    queue->front = (queue->front + 1) % queue->capacity;
-    queue->size = queue->size - 1;
-    return item;
-}
-Node* createNode(char* value, int position, int depth) {
-    Node* node = (Node*)malloc(sizeof(Node));
-    strcpy(node->value, value);
-    node->position = position;
-    node->depth = depth;
-    node->num_children = 0;
-    node->children = NULL;
-    return node;
-}
-
-void addChild(Node* parent, Node* child) {
-    parent->num_children++;
-    parent->children = (Node**)realloc(parent->children, parent->num_children * sizeof(Node*));
-    parent->children[parent->num_children - 1] = child;
-}
-
-
 int hamming_distance(char *str1, char *str2) {
     int count = 0;
     for (int i = 0; i < strlen(str1); i++) {
@@ -168,40 +155,25 @@ int hamming_distance(char *str1, char *str2) {
 }
 
 void calculate_n_values(char *x, char *y, char *z, int l, int n_values[l][N]) {
-    /* Counting types of differences between three k-mers */
-    for (int p = 0; p < l; p++) {
-        int n1 = 0, n2 = 0, n3 = 0, n4 = 0, n5 = 0;
-        for (int i = p; i < l; i++) {
-            if (x[i] == y[i] && y[i] == z[i]) {
-                n1++;
-            } else if (x[i] == y[i] && y[i] != z[i]) {
-                n2++;
-            } else if (x[i] == z[i] && z[i] != y[i]) {
-                n3++;
-            } else if (y[i] == z[i] && z[i] != x[i]) {
-                n4++;
-            } else {
-                n5++;
-            }
+    /* Counting types of differences between three k-mers from each position to the end */
+    int n[N] = {0, 0, 0, 0, 0};
+    for (int p = l - 1; p >= 0; p--) {
+        if (x[p] == y[p] && y[p] == z[p]) {
+            n[0]++;
+        } else if (x[p] == y[p] && y[p] != z[p]) {
+            n[1]++;
+        } else if (x[p] == z[p] && z[p] != y[p]) {
+            n[2]++;
+        } else if (y[p] == z[p] && z[p] != x[p]) {
+            n[3]++;
+        } else {
+            n[4]++;
         }
-        n_values[p][0] = n1;
-        n_values[p][1] = n2;
-        n_values[p][2] = n3;
-        n_values[p][3] = n4;
-        n_values[p][4] = n5;
+        memcpy(n_values[p], n, sizeof(n));
     }
 }
 
 
-void freeTree(Node* node) {
-    for (int i = 0; i < node->num_children; i++) {
-        freeTree(node->children[i]);
-    }
-    free(node->children);
-    free(node);
-}
-
-
 bool is_visited(const char* value, char visited[MAX_VISITED][MAX_LEN]) {
     for (int i = 0; i < MAX_VISITED; i++) {
         if (strcmp(visited[i], value) == 0) {
@@ -222,57 +194,6 @@ void mark_visited(const char* value, char visited[MAX_VISITED][MAX_LEN]) {
 }
 
 
-void generate_tree_bfs(Node* root, int max_depth, char* alphabet, int alphabet_size) {
-    /* 
-        Storing nodes in queue, iterate through nucleotides and create new child node,
-        that will differ from parent in position that is the same as depth that child is at.
-     */
-    Queue* queue = createQueue(MAX_Q_SIZE);
-    enqueue(queue, root);
-
-    while (!isQueueEmpty(queue)) {
-        Node* current_node = dequeue(queue);
-        if (current_node->depth == max_depth) {
-            continue;
-        }
-        int n = strlen(current_node->value);
-        char *x = (char *) malloc(MAX_LEN * sizeof(char));
-        strcpy(x, current_node->value);
-
-        for (int p1 = current_node->position + 1; p1 <= n; p1++) {
-            for (int s = 0; s < alphabet_size; s++) {
-                if (x[p1 - 1] != alphabet[s]) {
-                    char *new_x = (char *) malloc(MAX_LEN * sizeof(char));
-                    strcpy(new_x, x);
-                    new_x[p1 - 1] = alphabet[s];
-
-                    Node* new_node = createNode(new_x, p1, current_node->depth + 1);
-                    addChild(current_node, new_node);
-                    enqueue(queue, new_node);
-                    free(new_x);
-                }
-            }
-        }
-        free(x);
-    }
-
-    while (!isQueueEmpty(queue)) { //
-        Node* node_to_free = dequeue(queue);//
-        freeTree(node_to_free);//
-    }//
-
-    free(queue->items);
-    free(queue);
-}
-
-
-Node* make_T_neigh(char* x, int d, char* alphabet, int alphabet_size) {
-    /* Generate tree with all neighbours for k-mer x. */
-    Node* root = createNode(x, 0, 0);
-    generate_tree_bfs(root, d, alphabet, alphabet_size);
-    return root;
-}
-
 int distance(char* kmer, char** sequences, int num_sequences, int j) {
     int n = strlen(kmer);
     int maxim = 0;
@@ -284,6 +205,7 @@ int distance(char* kmer, char** sequences, int num_sequences, int j) {
         for (int i = 0; i <= strlen(s) - n; i++) {
             char *substr = slice(s, i, n);
             int dis = hamming_distance(kmer, substr);
+            free(substr);
             if (dis < minim) {
                 minim = dis;
             }
@@ -298,247 +220,224 @@ int distance(char* kmer, char** sequences, int num_sequences, int j) {
 }
 
 
-Set* fullprune(char* x, char* y, char* z, int d, Node* root, bool******** ilp_table) {
+typedef struct {
+    kmer_t code;
+    kmer_t pending;
+    int position;
+    int depth;
+    int d_yt;
+    int d_zt;
+} PruneNode;
+
+void fullprune(char* x, char* y, char* z, int d, const IlpTable *ilp_table, char* alphabet, int alphabet_size, Set* q) {
     /*
-        Start DFS for the given tree, check if each node differes from nodes x, y and z on less than d positions each.
-        If so the node is common neighbour and it is saved.
-        Then we check for value from table where all linear combinations are saved if node has potential to have a 
-        descendant that can be neighbour of all three nodes, if the answer is no, we perform backtracking.
+        Iterative DFS over the d-neighbourhood of x, on packed l-mers. A node t only differs from x at positions before
+        its position p, so d(x, t) is its depth, and d(y, t) and d(z, t) are carried on the stack and updated for
+        the one character a child changes. If t is at most d from x, y and z it is a common neighbour and it is added to q.
+        Without the unchanged suffix the same counters give the prefix distances, and the ILP table tells
+        if t has a descendant that can be a neighbour of all three; if not, its children are not pushed.
+        Children are pushed in reverse so they are visited in the same order as with recursion.
+        A character outside of the alphabet (see pack_kmer) differs from every character of t. In y and z it is
+        always counted as a mismatch. In x it has to be changed to one of alphabet_size characters at the cost
+        of one change, pending holds such positions of t that are not changed yet and t is a neighbour only without them.
     */
     int l = strlen(x);
-    Set* q = create_set(100);
-    int d_xy = hamming_distance(x, y);
-    int d_xz = hamming_distance(x, z);
 
     int n_values[MAX_LEN][N];
     calculate_n_values(x, y, z, l, n_values);
 
-    Queue* stack = createQueue(1000);
-    enqueue(stack, root);
+    int codes[256];
+    build_symbol_codes(alphabet, alphabet_size, codes);
+    kmer_t x_bad, y_bad, z_bad;
+    kmer_t x_code = pack_kmer(x, l, codes, &x_bad);
+    kmer_t y_code = pack_kmer(y, l, codes, &y_bad);
+    kmer_t z_code = pack_kmer(z, l, codes, &z_bad);
+    if (__builtin_popcountll(x_bad) > d) {
+        return;
+    }
 
-    while (!isQueueEmpty(stack)) {
-        Node* node = dequeue(stack);
-        int p = node->position;
-        char* t = node->value;
+    /* Suffix distances from x, so prefix distance of a node at p is its distance minus suffix[p]. */
+    int y_suffix[MAX_LEN + 1], z_suffix[MAX_LEN + 1];
+    y_suffix[l] = z_suffix[l] = 0;
+    for (int p = l - 1; p >= 0; p--) {
+        int shift = 2 * (l - 1 - p);
+        y_suffix[p] = y_suffix[p + 1] + (((x_bad | y_bad) >> shift) & 1 || x[p] != y[p]);
+        z_suffix[p] = z_suffix[p + 1] + (((x_bad | z_bad) >> shift) & 1 || x[p] != z[p]);
+    }
 
-        int d_xt = hamming_distance(x, t);
-        int d_yt = hamming_distance(y, t);
-        int d_zt = hamming_distance(z, t);
+    /* Every level keeps at most alphabet_size * l children waiting. */
+    PruneNode stack[MAX_LEN * 4 * MAX_LEN + 1];
+    int top = 0;
+    stack[top++] = (PruneNode){x_code, x_bad, 0, 0, y_suffix[0], z_suffix[0]};
 
-        if (d_xt <= d && d_yt <= d && d_zt <= d) {
-            add_to_set(q, t);
+    while (top > 0) {
+        PruneNode node = stack[--top];
+        int p = node.position;
+        int unchanged = 2 * (l - p) >= 64 ? 0 : __builtin_popcountll(node.pending >> (2 * (l - p)));
+        if (unchanged > 0) {
+            continue;
+        }
+        if (node.pending == 0 && node.d_yt <= d && node.d_zt <= d) {
+            add_to_set(q, node.code);
         }
 
-        char* x1 = (char *) malloc(MAX_LEN * sizeof(char));
-        char* y1 = (char *) malloc(MAX_LEN * sizeof(char));
-        char* z1 = (char *) malloc(MAX_LEN * sizeof(char));
-        char* t1 = (char *) malloc(MAX_LEN * sizeof(char));
-
-        strncpy(x1, x, p);
-        x1[p] = '\0';
-        strncpy(y1, y, p);
-        y1[p] = '\0';
-        strncpy(z1, z, p);
-        z1[p] = '\0';
-        strncpy(t1, t, p);
-        t1[p] = '\0';
-
-        int d_x1t1 = hamming_distance(x1, t1);
-        int d_y1t1 = hamming_distance(y1, t1);
-        int d_z1t1 = hamming_distance(z1, t1);
-
-        if (d_y1t1 > d || d_z1t1 > d) {
-            free(x1); //
-            free(y1);//
-            free(z1);//
-            free(t1);//
+        int d_y1t1 = node.d_yt - y_suffix[p];
+        int d_z1t1 = node.d_zt - z_suffix[p];
+        if (d_y1t1 > d || d_z1t1 > d || node.depth + __builtin_popcountll(node.pending) > d || node.depth == d) {
+            continue;
+        }
+        if (p < l && !ilp_lookup(ilp_table, n_values[p], d - node.depth, d - d_y1t1, d - d_z1t1)) {
             continue;
         }
 
-        int p1 = d - d_x1t1;
-        int p2 = d - d_y1t1;
-        int p3 = d - d_z1t1;
-
-        if (p < strlen(t)) {
-            int n1 = n_values[p][0];
-            int n2 = n_values[p][1];
-            int n3 = n_values[p][2];
-            int n4 = n_values[p][3];
-            int n5 = n_values[p][4];
-            bool ilp_t = ilp_table[n1][n2][n3][n4][n5][p1][p2][p3];
-            if (!ilp_t) {
-                free(x1);//
-                free(y1);//
-                free(z1);//
-                free(t1);//
-                continue;//
-            } else {
-                for (int i = 0; i < node->num_children; i++) {
-                    enqueue(stack, node->children[i]);
+        for (int c = l - 1; c >= p; c--) {
+            int shift = 2 * (l - 1 - c);
+            kmer_t own = (x_code >> shift) & 3;
+            bool own_bad = (x_bad >> shift) & 1;
+            kmer_t y_char = (y_code >> shift) & 3;
+            kmer_t z_char = (z_code >> shift) & 3;
+            bool y_other = (y_bad >> shift) & 1;
+            bool z_other = (z_bad >> shift) & 1;
+            int y_before = own_bad || y_other || own != y_char;
+            int z_before = own_bad || z_other || own != z_char;
+            kmer_t cleared = node.code & ~((kmer_t)3 << shift);
+            kmer_t pending = node.pending & ~((kmer_t)1 << shift);
+            int choices = own_bad ? alphabet_size : alphabet_size - 1;
+            for (int g = choices - 1; g >= 0; g--) {
+                /* Same order as for_each_neighbour, Gray code steps for 4 characters, otherwise increasing. */
+                kmer_t a;
+                if (own_bad) {
+                    a = (kmer_t)g;
+                } else {
+                    a = alphabet_size == 4 ? own ^ gray_masks[g] : (kmer_t)g + ((kmer_t)g >= own);
                 }
+                stack[top++] = (PruneNode){cleared | (a << shift), pending, c + 1, node.depth + 1,
+                                           node.d_yt - y_before + (y_other || a != y_char),
+                                           node.d_zt - z_before + (z_other || a != z_char)};
             }
         }
-        free(x1);
-        free(y1);
-        free(z1);
-        free(t1);
     }
-
-    while (!isQueueEmpty(stack)) {//
-        Node* node_to_free = dequeue(stack); //
-        freeTree(node_to_free); //
-    }//
-
-    free(stack->items);
-    free(stack);
-    return q;
 }
 
 
 
-bool******** allocate_8d_array(int l, int d) {
-    bool******** array = (bool********)malloc((l + 1) * sizeof(bool*******));
-    for (int i = 0; i <= l; i++) {
-        array[i] = (bool*******)malloc((l + 1) * sizeof(bool******));
-        for (int j = 0; j <= l; j++) {
-            array[i][j] = (bool******)malloc((l + 1) * sizeof(bool*****));
-            for (int k = 0; k <= l; k++) {
-                array[i][j][k] = (bool*****)malloc((l + 1) * sizeof(bool****));
-                for (int m = 0; m <= l; m++) {
-                    array[i][j][k][m] = (bool****)malloc((l + 1) * sizeof(bool***));
-                    for (int n = 0; n <= l; n++) {
-                        array[i][j][k][m][n] = (bool***)malloc((d + 1) * sizeof(bool**));
-                        for (int o = 0; o <= d; o++) {
-                            array[i][j][k][m][n][o] = (bool**)malloc((d + 1) * sizeof(bool*));
-                            for (int p = 0; p <= d; p++) {
-                                array[i][j][k][m][n][o][p] = (bool*)malloc((d + 1) * sizeof(bool));
-                            }
-                        }
-                    }
-                }
+typedef struct {
+    char **sequences;
+    int num_sequences;
+    int l;
+    int d;
+    const IlpTable *ilp_table;
+    char *alphabet;
+    int alphabet_size;
+    TaskQueue *tasks;
+    Set *found;
+} Worker;
+
+void find_motifs_for_x(Worker *worker, int i, Set *q1, Set *q) {
+    /*
+        Iterating through k-mers from all pairs of rest of the sequences for the i-th k-mer x of the first sequence.
+        For each pair of three k-mers use fullprune algorithm to find common neighbours.
+        Store union of neighbours from all k-mers from paired sequences and x in set Q,
+        kept as sorted packed k-mers so union and intersection are merges.
+        Check if the set is smaller than trashold, if so check if there is real motif, if not do the intersection of set Q
+        with set form previous pair of sequences.
+     */
+    char **sequences = worker->sequences;
+    int l = worker->l;
+    int d = worker->d;
+    int p = (worker->num_sequences - 1) / 2;
+    char x[MAX_LEN], y[MAX_LEN], z[MAX_LEN];
+    strncpy(x, sequences[0] + i, l);
+    x[l] = '\0';
+    y[l] = '\0';
+    z[l] = '\0';
+    int k = 0;
+    for (k = 0; k < p; k++) {
+        char* s2 = sequences[2 * k + 1];
+        char* s3 = sequences[2 * k + 2];
+        Set* target = k == 0 ? q1 : q;
+        clear_set(target);
+        for (int j = 0; j < strlen(s2) - l + 1; j++) {
+            strncpy(y, s2 + j, l);
+            for (int r = 0; r < strlen(s3) - l + 1; r++) {
+                strncpy(z, s3 + r, l);
+                fullprune(x, y, z, d, worker->ilp_table, worker->alphabet, worker->alphabet_size, target);
             }
         }
+        normalize_set(target);
+        if (k > 0) {
+            set_intersection(q1, q);
+        }
+        if (q1->size < Q_TRESHOLD) {
+            break;
+        }
     }
-    return array;
-}
-
-void free_8d_array(bool******** array, int l, int d) {
-    for (int i = 0; i <= l; i++) {
-        for (int j = 0; j <= l; j++) {
-            for (int k = 0; k <= l; k++) {
-                for (int m = 0; m <= l; m++) {
-                    for (int n = 0; n <= l; n++) {
-                        for (int o = 0; o <= d; o++) {
-                            for (int p = 0; p <= d; p++) {
-                                free(array[i][j][k][m][n][o][p]);
-                            }
-                            free(array[i][j][k][m][n][o]);
-                        }
-                        free(array[i][j][k][m][n]);
-                    }
-                    free(array[i][j][k][m]);
-                }
-                free(array[i][j][k]);
-            }
-            free(array[i][j]);
+    char candidate[MAX_LEN];
+    for (int s = 0; s < q1->size; s++) {
+        unpack_kmer(q1->items[s], l, worker->alphabet, candidate);
+        if (distance(candidate, sequences, worker->num_sequences, k*2+3) <= d) {
+            add_to_set(worker->found, q1->items[s]);
         }
-        free(array[i]);
     }
-    free(array);
 }
 
-
-bool******** read_table_from_file(int l, int d, char* filename) {
-    /*
-        Read previously created table with values for all combinations of ns and ps.
-        Table has 8 int numbers and one bool -> 3 2 0 0 1 2 2 1 true
-    */
-    bool******** table = allocate_8d_array(l, d);
-    FILE* file = fopen(filename, "r");
-    if (file == NULL) {
-        perror("Failed to open file");
-        return NULL;
-    }
-
-    int n1, n2, n3, n4, n5, p1, p2, p3;
-    char value[6];
-    while (fscanf(file, "%d %d %d %d %d %d %d %d %s\n", &n1, &n2, &n3, &n4, &n5, &p1, &p2, &p3, value) == 9) {
-        table[n1][n2][n3][n4][n5][p1][p2][p3] = (strcmp(value, "true") == 0);
+void *run_worker(void *arg) {
+    /* K-mers of the first sequence are handed out from a shared counter, Q sets are reused between them. */
+    Worker *worker = (Worker *)arg;
+    Set* q1 = create_set(SET_SIZE);
+    Set* q = create_set(SET_SIZE);
+    int i;
+    while (next_task(worker->tasks, &i)) {
+        find_motifs_for_x(worker, i, q1, q);
     }
+    free_set(q1);
+    free_set(q);
+    return NULL;
+}
 
-    fclose(file);
-    return table;
+double wall_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-Set* pms5(char** sequences, int num_sequences, int l, int d, char* filename, char* alphabet, int alphabet_size) {
+Set* pms5(char** sequences, int num_sequences, int l, int d, char* filename, char* alphabet, int alphabet_size, int num_threads) {
     /*
-        Iterating through k-mers in first sequences and k-mers from all pairs of rest of the sequences.
-        For each pair of three k-mers use fullprune algorithm to find common neighbours.
-        Store union of neighbours from all k-mers from paired sequences and fixed k-mer from first one in set Q.
-        Check if the set is smaller than trashold, if so check if there is real motif, if not do the intersection of set Q
-        with set form previous pair of sequences. This is done in iterations for all k-mers in first sequences.
+        K-mers x of the first sequence are independent, so num_threads workers take them one by one, all reading
+        the same mapped ILP table. Each worker collects the motifs it finds, and the union of their sets
+        is the result, so a motif found from several x is printed once, in alphabet order.
      */
     Set* res_mot = create_set(SET_SIZE);
     if (num_sequences % 2 == 0) {
         sequences[num_sequences] = sequences[num_sequences - 1];
         num_sequences++;
     }
-    int p = (num_sequences - 1) / 2;
-    char* s1 = sequences[0];
-    Set* q1 = create_set(SET_SIZE);
-    bool******** ilp_table = read_table_from_file(l, d, filename);
-
-    for (int i = 0; i < strlen(s1) - l + 1; i++) {
-        char *x = (char *)malloc(MAX_LEN*sizeof(char));
-        strncpy(x, s1 + i, l);
-        x[l] = '\0';
-        Node* root = make_T_neigh(x, d, alphabet, alphabet_size);
-        int k = 0;
-        for (k = 0; k < p; k++) {
-            Set* q = create_set(100);
-            char* s2 = sequences[2 * k + 1];
-            char* s3 = sequences[2 * k + 2];
-            for (int j = 0; j < strlen(s2) - l + 1; j++) {
-                char *y = (char *)malloc(MAX_LEN*sizeof(char));
-                strncpy(y, s2 + j, l);
-                y[l] = '\0';
-                for (int r = 0; r < strlen(s3) - l + 1; r++) {
-                    char *z = (char *)malloc(MAX_LEN*sizeof(char));
-                    strncpy(z, s3 + r, l);
-                    z[l] = '\0';
-                    Set* neighbors_of_all = fullprune(x, y, z, d, root, ilp_table);
-                    Set* temp_q = set_union(q, neighbors_of_all);
-                    free_set(q);
-                    q = temp_q;
-                    free_set(neighbors_of_all);
-                    free(z);
-                }
-                free(y);
-            }
-            if (k == 0) {
-                free_set(q1);
-                q1 = q;
-            } else {
-                Set* temp_q1 = set_intersection(q1, q);
-                free_set(q1);
-                q1 = temp_q1;
-                free_set(q);
-            }
-            if (q1->size < Q_TRESHOLD) {
-                break;
-            }
-        }
-        for (int s = 0; s < q1->size; s++) {
-            if (distance(q1->items[s], sequences, num_sequences, k*2+3) <= d) {
-                add_to_set(res_mot, q1->items[s]);
-                printf("Pronadjen motiv: %s\n", q1->items[s]);
-            }
-        }
-        free(x);
-        freeTree(root);
+    double load_start = wall_time();
+    IlpTable *ilp_table = open_ilp_table(l, d, filename, sysconf(_SC_NPROCESSORS_ONLN));
+    if (ilp_table == NULL) {
+        return res_mot;
+    }
+    printf("Ucitavanje tabele: %lfs\n", wall_time() - load_start);
+
+    TaskQueue tasks = {0, (int)strlen(sequences[0]) - l + 1};
+    Worker *workers = (Worker *)malloc(num_threads * sizeof(Worker));
+    for (int t = 0; t < num_threads; t++) {
+        workers[t] = (Worker){sequences, num_sequences, l, d, ilp_table, alphabet, alphabet_size, &tasks, create_set(SET_SIZE)};
+    }
+    run_workers(run_worker, workers, sizeof(Worker), num_threads);
+
+    for (int t = 0; t < num_threads; t++) {
+        set_union(res_mot, workers[t].found);
+        free_set(workers[t].found);
+    }
+    free(workers);
+    free_ilp_table(ilp_table);
+
+    char motif[MAX_LEN];
+    for (int s = 0; s < res_mot->size; s++) {
+        unpack_kmer(res_mot->items[s], l, alphabet, motif);
+        printf("Pronadjen motiv: %s\n", motif);
     }
-    free_set(q1);
-    free_8d_array(ilp_table, l, d);
     return res_mot;
 }
 
@@ -554,6 +453,7 @@ char **read_lines_from_file(const char *file_path, int *num_lines) {
     *num_lines = 0;
 
     while (fgets(buffer, sizeof(buffer), file)) {
+        buffer[strcspn(buffer, "\n")] = '\0';
         lines[*num_lines] = strdup(buffer);
         (*num_lines)++;
     }
@@ -583,41 +483,64 @@ char* read_alphabet(const char *file_name, int *num_chars) {
 
 int main(int argc, char *argv[]) {
 
-    if (argc < 5) {
-        fprintf(stderr, "Argumenti: <duzina_motiva> <broj_mutacija> <datoteka_sa_sekvencama> <datoteka_ilr_tabela> [<datoteka_sa_azbukom>]\n");
+    /* Options may appear anywhere, what is left are positional arguments. */
+    int num_threads = 1;
+    char *args[6];
+    int num_args = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            num_threads = atoi(argv[++i]);
+        } else if (num_args < 6) {
+            args[num_args++] = argv[i];
+        }
+    }
+
+    if (num_args < 5) {
+        fprintf(stderr, "Argumenti: <duzina_motiva> <broj_mutacija> <datoteka_sa_sekvencama> <datoteka_ilr_tabela> [<datoteka_sa_azbukom>] [--threads <broj_niti>]\n");
         return 1;
     }
 
-    int l = atoi(argv[1]);
-    int d = atoi(argv[2]);
+    int l = atoi(args[1]);
+    int d = atoi(args[2]);
     if (l<0 || d<0){
         fprintf(stderr, "Argumenti duzina motiva i dozvoljene mutacije moraju biti veci od 0.\n");
         return 1;
     }
+    if (num_threads < 1) {
+        fprintf(stderr, "Broj niti mora biti veci od 0.\n");
+        return 1;
+    }
 
     int num_sequences;
-    char **sequences = read_lines_from_file(argv[3], &num_sequences);
+    char **sequences = read_lines_from_file(args[3], &num_sequences);
 
-    char *alphabet = (char *)malloc(25*sizeof(char));
+    char *alphabet;
     int alphabet_size;
 
-    if (argc == 6) {
-        alphabet = read_alphabet(argv[5], &alphabet_size);
+    if (num_args == 6) {
+        alphabet = read_alphabet(args[5], &alphabet_size);
     } else{
         alphabet = strdup("acgt");
         alphabet_size = 4;
     }
 
-    clock_t start = clock();
-    pms5(sequences, num_sequences, l, d, argv[4], alphabet, alphabet_size);
-    clock_t end = clock();
+    /* K-mers are packed 2 bits per character and held in MAX_LEN buffers with their terminating zero. */
+    if (alphabet_size > 4 || l >= MAX_LEN) {
+        fprintf(stderr, "Azbuka moze imati najvise 4 karaktera, a duzina motiva najvise %d.\n", MAX_LEN - 1);
+        return 1;
+    }
 
-    printf("Vreme: %lfs\n", (double)(end - start) / CLOCKS_PER_SEC);
+    double start = wall_time();
+    Set* motifs = pms5(sequences, num_sequences, l, d, args[4], alphabet, alphabet_size, num_threads);
+    double end = wall_time();
 
+    printf("Vreme: %lfs\n", end - start);
+
+    free_set(motifs);
     for (int i = 0; i < num_sequences; i++) {
         free(sequences[i]);
     }
     free(sequences);
     free(alphabet);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ilp_table.h"
+
+double wall_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+
+    /*
+        Writes the binary ILP table pms5 maps at startup. Without a text table the cells are computed here
+        on the given number of threads, with one the text table is converted.
+     */
+    int num_threads = 1;
+    char *args[5];
+    int num_args = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            num_threads = atoi(argv[++i]);
+        } else if (num_args < 5) {
+            args[num_args++] = argv[i];
+        }
+    }
+
+    if (num_args < 4) {
+        fprintf(stderr, "Argumenti: <duzina_motiva> <broj_mutacija> <izlazna_datoteka> [<tekstualna_tabela>] [--threads <broj_niti>]\n");
+        return 1;
+    }
+
+    int l = atoi(args[1]);
+    int d = atoi(args[2]);
+    if (l<0 || d<0){
+        fprintf(stderr, "Argumenti duzina motiva i dozvoljene mutacije moraju biti veci od 0.\n");
+        return 1;
+    }
+    if (num_threads < 1) {
+        fprintf(stderr, "Broj niti mora biti veci od 0.\n");
+        return 1;
+    }
+
+    double start = wall_time();
+    IlpTable *table = num_args == 5 ? read_text_ilp_table(l, d, args[4]) : generate_ilp_table(l, d, num_threads);
+    if (table == NULL) {
+        return 1;
+    }
+    if (!write_ilp_table(table, args[3])) {
+        free_ilp_table(table);
+        return 1;
+    }
+    double end = wall_time();
+
+    printf("Tabela za l = %d i d = %d upisana u %s (%zu bajtova)\n", l, d, args[3], ILP_HEADER_SIZE + (ilp_cells(l, d) + 7) / 8);
+    printf("Vreme: %lfs\n", end - start);
+    free_ilp_table(table);
+    return 0;
+}
@@ -4,196 +4,646 @@
 #include <stdbool.h>
 #include <time.h>
 #include <math.h>
-
-#define MAX_MOTIF_LENGTH 25
-#define MAX_VALID_MOTIFS 10
-#define HASH_SIZE 100000
+#include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "task_queue.h"
+
+#define MAX_MOTIF_LENGTH 33
+#define TASKS_PER_THREAD 16
+#define DIRECT_LEVEL_SIZE 65536
+#define INITIAL_LEVEL_SIZE 1024
+#define EMPTY_VALUE INT_MIN
 #define MAX_LINES 1000
 #define MAX_BUFFER 1200
 #define MAX_LINE_LENGTH 100
 
 
-typedef struct Entry {
-    char *key;
-    int value;
-    struct Entry *next;
-} Entry;
+typedef struct {
+    uint64_t *keys;
+    int *values;
+    size_t capacity;
+    size_t size;
+    bool direct;
+    pthread_rwlock_t lock;
+} ExtLevel;
 
 typedef struct {
-    Entry **buckets;
-    int size;
-} HashTable;
-
-int hamming_distance(const char *seq1, const char *seq2, int length) {
-    int distance = 0;
-    for (int i = 0; i < length; i++) {
-        if (seq1[i] != seq2[i]) {
-            distance++;
-        }
+    ExtLevel *levels;
+    int max_len;
+    int bits;
+    bool shared;
+} MaxExtTable;
+
+typedef struct {
+    char **motifs;
+    int count;
+    int capacity;
+    FILE *out;
+    pthread_mutex_t lock;
+} MotifCollector;
+
+typedef struct {
+    int depth;
+    int lo;
+    int hi;
+    int first_child;
+    int next_sibling;
+} SuffixNode;
+
+typedef struct {
+    int *text;
+    int n;
+    int *sa;
+    int *lcp;
+    SuffixNode *nodes;
+    int num_nodes;
+    uint64_t *seqs;
+    int words;
+    int *seq_of;
+} SuffixIndex;
+
+typedef struct {
+    int node;
+    int mismatches;
+} Occurrence;
+
+typedef struct {
+    Occurrence **levels;
+    int *sizes;
+    int depth;
+    uint64_t *covered;
+} OccurrenceStack;
+
+typedef struct {
+    TaskQueue *tasks;
+    int prefix_len;
+    SuffixIndex *index;
+    int quorum;
+    int max_mismatches;
+    int k_min;
+    int k_max;
+    MaxExtTable *max_ext;
+    MotifCollector *found;
+    char *alphabet;
+    int alphabet_size;
+    OccurrenceStack occurrences;
+} Worker;
+
+static const int *sort_text;
+
+int compare_suffixes(const void *a, const void *b) {
+    /* Every sequence ends with its own negative separator, so two suffixes always differ before running out. */
+    const int *x = sort_text + *(const int *)a;
+    const int *y = sort_text + *(const int *)b;
+    while (*x == *y) {
+        x++;
+        y++;
     }
-    return distance;
+    return (*x > *y) - (*x < *y);
 }
 
-bool is_valid(const char *motif, char **sequences, int num_sequences, int quorum, int max_mismatches) {
-    /* Checking if quorum is satisfied. */
-    bool *is_there = (bool *)malloc(num_sequences * sizeof(bool));
-    memset(is_there, false, num_sequences * sizeof(bool));
-    int mot_len = strlen(motif);
-    for (int j = 0; j < num_sequences; j++) {
-        for (int i = 0; i <= strlen(sequences[j]) - mot_len; i++) {
-            if (hamming_distance(motif, &sequences[j][i], mot_len) <= max_mismatches) {
-                is_there[j] = true;
-                break;
+int add_node(SuffixIndex *index, int depth, int lo, int hi) {
+    int id = index->num_nodes++;
+    index->nodes[id] = (SuffixNode){depth, lo, hi, -1, -1};
+    memset(&index->seqs[(size_t)id * index->words], 0, index->words * sizeof(uint64_t));
+    return id;
+}
+
+int build_node(SuffixIndex *index, int depth, int lo, int hi) {
+    /*
+        Node for suffix array interval [lo, hi) whose suffixes share their first depth characters.
+        Children are the runs of suffixes with the same character at position depth, a run of one suffix is a leaf
+        that goes until the end of its sequence. Node's sequence set is the union of its children's.
+     */
+    int id = add_node(index, depth, lo, hi);
+    uint64_t *seqs = &index->seqs[(size_t)id * index->words];
+    if (hi - lo == 1) {
+        int seq = index->seq_of[index->sa[lo]];
+        index->nodes[id].depth = 0;
+        while (index->text[index->sa[lo] + index->nodes[id].depth] >= 0) {
+            index->nodes[id].depth++;
+        }
+        seqs[seq / 64] |= 1ULL << (seq % 64);
+        return id;
+    }
+
+    int last_child = -1;
+    int start = lo;
+    while (start < hi) {
+        int c = index->text[index->sa[start] + depth];
+        int end = start + 1;
+        int child_depth = INT_MAX;
+        while (end < hi && index->text[index->sa[end] + depth] == c) {
+            if (index->lcp[end] < child_depth) {
+                child_depth = index->lcp[end];
             }
+            end++;
+        }
+        int child = build_node(index, child_depth, start, end);
+        if (last_child < 0) {
+            index->nodes[id].first_child = child;
+        } else {
+            index->nodes[last_child].next_sibling = child;
+        }
+        last_child = child;
+        seqs = &index->seqs[(size_t)id * index->words];
+        for (int w = 0; w < index->words; w++) {
+            seqs[w] |= index->seqs[(size_t)child * index->words + w];
         }
+        start = end;
     }
+    return id;
+}
 
-    int count = 0;
+SuffixIndex build_suffix_index(char **sequences, int num_sequences) {
+    /*
+        Generalized suffix array with LCP over all sequences joined by separators, turned into a suffix tree
+        whose nodes know which sequences they occur in. Root is node 0. Identical substrings share a node,
+        so searching over nodes handles them once. The index does not depend on l or d and can be reused.
+     */
+    SuffixIndex index;
+    index.n = 0;
     for (int j = 0; j < num_sequences; j++) {
-        if (is_there[j]) {
-            count++;
+        index.n += strlen(sequences[j]) + 1;
+    }
+    index.text = (int *)malloc((index.n + 1) * sizeof(int));
+    index.seq_of = (int *)malloc((index.n + 1) * sizeof(int));
+    int num_suffixes = 0;
+    int k = 0;
+    for (int j = 0; j < num_sequences; j++) {
+        for (int i = 0; sequences[j][i] != '\0'; i++) {
+            index.seq_of[k] = j;
+            index.text[k++] = (unsigned char)sequences[j][i];
+            num_suffixes++;
         }
+        index.seq_of[k] = j;
+        index.text[k++] = -(j + 1);
     }
-    free(is_there);
-    return count >= quorum;
-}
 
-unsigned int hash_fun(const char *key, int table_size) {
-    unsigned long hash = 5381;
-    int c;
-    while ((c = *key++)) {
-        hash = ((hash << 5) + hash) + c;
+    index.sa = (int *)malloc((num_suffixes > 0 ? num_suffixes : 1) * sizeof(int));
+    int s = 0;
+    for (int i = 0; i < index.n; i++) {
+        if (index.text[i] >= 0) {
+            index.sa[s++] = i;
+        }
+    }
+    sort_text = index.text;
+    qsort(index.sa, num_suffixes, sizeof(int), compare_suffixes);
+
+    /* Kasai's algorithm, lcp[i] is the common prefix of suffixes sa[i - 1] and sa[i]. */
+    int *rank = (int *)malloc((index.n + 1) * sizeof(int));
+    index.lcp = (int *)calloc(num_suffixes > 0 ? num_suffixes : 1, sizeof(int));
+    for (int i = 0; i < index.n; i++) {
+        rank[i] = -1;
+    }
+    for (int i = 0; i < num_suffixes; i++) {
+        rank[index.sa[i]] = i;
+    }
+    int h = 0;
+    for (int i = 0; i < index.n; i++) {
+        if (rank[i] < 0) {
+            h = 0;
+            continue;
+        }
+        if (rank[i] > 0) {
+            int j = index.sa[rank[i] - 1];
+            while (index.text[i + h] >= 0 && index.text[i + h] == index.text[j + h]) {
+                h++;
+            }
+            index.lcp[rank[i]] = h;
+            if (h > 0) {
+                h--;
+            }
+        } else {
+            h = 0;
+        }
+    }
+    free(rank);
+
+    index.words = (num_sequences + 63) / 64;
+    if (index.words == 0) {
+        index.words = 1;
     }
-    return hash % table_size;
+    index.nodes = (SuffixNode *)malloc((2 * num_suffixes + 1) * sizeof(SuffixNode));
+    index.seqs = (uint64_t *)malloc((size_t)(2 * num_suffixes + 1) * index.words * sizeof(uint64_t));
+    index.num_nodes = 0;
+    if (num_suffixes > 0) {
+        build_node(&index, 0, 0, num_suffixes);
+    } else {
+        add_node(&index, 0, 0, 0);
+    }
+    return index;
 }
 
-void insert(HashTable *table, const char *key, int value) {
-    unsigned int bucket = hash_fun(key, table->size);
-    Entry *current = table->buckets[bucket];
-    while (current != NULL) {
-        if (strcmp(current->key, key) == 0) {
-            current->value = value;
-            return;
-        }
-        current = current->next;
+void free_suffix_index(SuffixIndex *index) {
+    free(index->text);
+    free(index->seq_of);
+    free(index->sa);
+    free(index->lcp);
+    free(index->nodes);
+    free(index->seqs);
+}
+
+OccurrenceStack create_occurrence_stack(SuffixIndex *index, int k_max) {
+    /*
+        Level m keeps the occurrences of the current motif of length m: points in the suffix tree at depth m,
+        on the edge into the given node, whose path differs from the motif on at most d positions, with
+        the number of mismatches so far. Level 0 is the root.
+     */
+    OccurrenceStack stack;
+    stack.depth = k_max + 1;
+    stack.levels = (Occurrence **)malloc(stack.depth * sizeof(Occurrence *));
+    stack.sizes = (int *)calloc(stack.depth, sizeof(int));
+    for (int m = 0; m < stack.depth; m++) {
+        stack.levels[m] = (Occurrence *)malloc(index->num_nodes * sizeof(Occurrence));
     }
+    stack.levels[0][stack.sizes[0]++] = (Occurrence){0, 0};
+    stack.covered = (uint64_t *)malloc(index->words * sizeof(uint64_t));
+    return stack;
+}
 
-    Entry *new_entry = malloc(sizeof(Entry));
-    new_entry->key = strdup(key);
-    new_entry->value = value;
-    new_entry->next = table->buckets[bucket];
-    table->buckets[bucket] = new_entry;
+void free_occurrence_stack(OccurrenceStack *stack) {
+    for (int m = 0; m < stack->depth; m++) {
+        free(stack->levels[m]);
+    }
+    free(stack->levels);
+    free(stack->sizes);
+    free(stack->covered);
 }
 
-void free_table(HashTable *table) {
-    for (int i = 0; i < table->size; i++) {
-        Entry *entry = table->buckets[i];
-        while (entry != NULL) {
-            Entry *temp = entry;
-            entry = entry->next;
-            free(temp->key);
-            free(temp);
+int add_occurrence(OccurrenceStack *stack, SuffixIndex *index, int length, int node, int mismatches, char c, int max_mismatches, int size) {
+    /* Moves one character down the tree from depth length inside node, keeping it if it is still close enough. */
+    int next = index->text[index->sa[index->nodes[node].lo] + length];
+    if (next < 0) {
+        return size;
+    }
+    if (next != (unsigned char)c) {
+        mismatches++;
+        if (mismatches > max_mismatches) {
+            return size;
         }
     }
-    free(table->buckets);
-    free(table);
+    stack->levels[length + 1][size] = (Occurrence){node, mismatches};
+    uint64_t *seqs = &index->seqs[(size_t)node * index->words];
+    for (int w = 0; w < index->words; w++) {
+        stack->covered[w] |= seqs[w];
+    }
+    return size + 1;
 }
 
-HashTable* create_table(int size) {
-    HashTable *table = malloc(sizeof(HashTable));
-    table->size = size;
-    table->buckets = malloc(size * sizeof(Entry*));
+bool extend_occurrences(OccurrenceStack *stack, int length, char c, SuffixIndex *index, int quorum, int max_mismatches) {
+    /*
+        Motif of given length is extended by c. An occurrence inside an edge has one way to continue, one that
+        reached its node continues into each child. Sequences covered by the new occurrences are the union of
+        their nodes' sequence sets. Checking if quorum is satisfied.
+     */
+    Occurrence *parent = stack->levels[length];
+    int size = 0;
+    memset(stack->covered, 0, index->words * sizeof(uint64_t));
+    for (int i = 0; i < stack->sizes[length]; i++) {
+        Occurrence occ = parent[i];
+        SuffixNode *node = &index->nodes[occ.node];
+        if (node->depth > length) {
+            size = add_occurrence(stack, index, length, occ.node, occ.mismatches, c, max_mismatches, size);
+            continue;
+        }
+        for (int child = node->first_child; child >= 0; child = index->nodes[child].next_sibling) {
+            size = add_occurrence(stack, index, length, child, occ.mismatches, c, max_mismatches, size);
+        }
+    }
+    stack->sizes[length + 1] = size;
+
+    int covered = 0;
+    for (int w = 0; w < index->words; w++) {
+        covered += __builtin_popcountll(stack->covered[w]);
+    }
+    return covered >= quorum;
+}
 
-    for (int i = 0; i < size; i++) {
-        table->buckets[i] = NULL;
+void init_level(ExtLevel *level, int len, int bits) {
+    /*
+        Prefixes of one length. When all alphabet^len of them fit in DIRECT_LEVEL_SIZE the packed prefix is the index,
+        otherwise it is an open-addressed table with linear probing. EMPTY_VALUE marks a free slot.
+     */
+    level->size = 0;
+    level->direct = (size_t)bits * len < 63 && (1ULL << (bits * len)) <= DIRECT_LEVEL_SIZE;
+    level->capacity = level->direct ? (1ULL << (bits * len)) : INITIAL_LEVEL_SIZE;
+    level->keys = level->direct ? NULL : (uint64_t *)malloc(level->capacity * sizeof(uint64_t));
+    level->values = (int *)malloc(level->capacity * sizeof(int));
+    for (size_t i = 0; i < level->capacity; i++) {
+        level->values[i] = EMPTY_VALUE;
     }
+    pthread_rwlock_init(&level->lock, NULL);
+}
 
+MaxExtTable* create_table(int max_len, int alphabet_size, bool shared) {
+    /*
+        When shared, several workers use the table at once. Direct levels are read and written atomically,
+        open-addressed levels are guarded by a read-write lock because inserting may grow them.
+     */
+    MaxExtTable *table = malloc(sizeof(MaxExtTable));
+    table->max_len = max_len;
+    table->shared = shared;
+    table->bits = 1;
+    while ((1 << table->bits) < alphabet_size) {
+        table->bits++;
+    }
+    table->levels = (ExtLevel *)malloc((max_len + 1) * sizeof(ExtLevel));
+    for (int len = 0; len <= max_len; len++) {
+        init_level(&table->levels[len], len, table->bits);
+    }
     return table;
 }
 
+size_t find_prefix(ExtLevel *level, uint64_t key) {
+    if (level->direct) {
+        return key;
+    }
+    size_t mask = level->capacity - 1;
+    size_t i = (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 17) & mask;
+    while (level->values[i] != EMPTY_VALUE && level->keys[i] != key) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
 
-int lookup(HashTable *table, const char *key) {
-    unsigned int bucket = hash_fun(key, table->size);
+void grow_level(ExtLevel *level) {
+    uint64_t *old_keys = level->keys;
+    int *old_values = level->values;
+    size_t old_capacity = level->capacity;
 
-    Entry *entry = table->buckets[bucket];
-    while (entry != NULL && strcmp(entry->key, key) != 0) {
-        entry = entry->next;
+    level->capacity *= 2;
+    level->keys = (uint64_t *)malloc(level->capacity * sizeof(uint64_t));
+    level->values = (int *)malloc(level->capacity * sizeof(int));
+    for (size_t i = 0; i < level->capacity; i++) {
+        level->values[i] = EMPTY_VALUE;
+    }
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_values[i] != EMPTY_VALUE) {
+            size_t j = find_prefix(level, old_keys[i]);
+            level->keys[j] = old_keys[i];
+            level->values[j] = old_values[i];
+        }
+    }
+    free(old_keys);
+    free(old_values);
+}
+
+void insert(MaxExtTable *table, int len, uint64_t key, int value) {
+    ExtLevel *level = &table->levels[len];
+    if (level->direct) {
+        __atomic_store_n(&level->values[key], value, __ATOMIC_RELAXED);
+        return;
+    }
+    if (table->shared) {
+        pthread_rwlock_wrlock(&level->lock);
     }
+    size_t i = find_prefix(level, key);
+    if (level->values[i] == EMPTY_VALUE) {
+        if (2 * (level->size + 1) > level->capacity) {
+            grow_level(level);
+            i = find_prefix(level, key);
+        }
+        level->size++;
+        level->keys[i] = key;
+    }
+    level->values[i] = value;
+    if (table->shared) {
+        pthread_rwlock_unlock(&level->lock);
+    }
+}
 
-    if (entry == NULL) {
-        return -1;
+int lookup(MaxExtTable *table, int len, uint64_t key) {
+    ExtLevel *level = &table->levels[len];
+    int value;
+    if (level->direct) {
+        value = __atomic_load_n(&level->values[key], __ATOMIC_RELAXED);
+    } else if (table->shared) {
+        pthread_rwlock_rdlock(&level->lock);
+        value = level->values[find_prefix(level, key)];
+        pthread_rwlock_unlock(&level->lock);
     } else {
-        return entry->value;
+        value = level->values[find_prefix(level, key)];
+    }
+    return value == EMPTY_VALUE ? -1 : value;
+}
+
+size_t table_memory(MaxExtTable *table) {
+    size_t bytes = sizeof(MaxExtTable) + (table->max_len + 1) * sizeof(ExtLevel);
+    for (int len = 0; len <= table->max_len; len++) {
+        ExtLevel *level = &table->levels[len];
+        bytes += level->capacity * (sizeof(int) + (level->direct ? 0 : sizeof(uint64_t)));
+    }
+    return bytes;
+}
+
+uint64_t suffix_mask(int len, int bits) {
+    return bits * len >= 64 ? ~0ULL : ((1ULL << (bits * len)) - 1);
+}
+
+void free_table(MaxExtTable *table) {
+    for (int len = 0; len <= table->max_len; len++) {
+        free(table->levels[len].keys);
+        free(table->levels[len].values);
+        pthread_rwlock_destroy(&table->levels[len].lock);
+    }
+    free(table->levels);
+    free(table);
+}
+
+void collect_motif(MotifCollector *found, const char *motif) {
+    /* Workers add motifs as they find them, the array doubles when full. With an output file motifs are written there instead. */
+    if (found->out != NULL) {
+        pthread_mutex_lock(&found->lock);
+        fprintf(found->out, "%s\n", motif);
+        found->count++;
+        pthread_mutex_unlock(&found->lock);
+        return;
+    }
+    char *copy = strdup(motif);
+    pthread_mutex_lock(&found->lock);
+    if (found->count == found->capacity) {
+        found->capacity = found->capacity ? 2 * found->capacity : 16;
+        found->motifs = (char **)realloc(found->motifs, found->capacity * sizeof(char *));
     }
+    found->motifs[found->count++] = copy;
+    pthread_mutex_unlock(&found->lock);
 }
 
-void extract_single_motif(const char *motif, char **sequences, int num_sequences, int quorum, int max_mismatches, int k_min, int k_max, char **valid_motifs, int *valid_motif_count, HashTable *max_ext, char* alphabet, int alphabet_size) {
+static int symbol_rank[256];
+
+int compare_motifs(const void *a, const void *b) {
+    /* Order of the serial search: by alphabet position, a prefix before its extensions. */
+    const unsigned char *x = *(const unsigned char **)a;
+    const unsigned char *y = *(const unsigned char **)b;
+    while (*x && *x == *y) {
+        x++;
+        y++;
+    }
+    if (!*x || !*y) {
+        return (int)*x - (int)*y;
+    }
+    return symbol_rank[*x] - symbol_rank[*y];
+}
+
+void record_extension(MaxExtTable *max_ext, int length, uint64_t code, int k_min) {
+    /*
+        Prefix of length k_min - 1 remembers how far past it the search got. A valid motif has to be recorded too,
+        otherwise a prefix whose extensions are all motifs would look like one that cannot be extended at all.
+     */
+    int prefix_len = k_min - 1;
+    uint64_t prefix = code >> (max_ext->bits * (length - prefix_len));
+    if (lookup(max_ext, prefix_len, prefix) < length - prefix_len) {
+        insert(max_ext, prefix_len, prefix, length - prefix_len);
+    }
+}
+
+bool extract_single_motif(const char *motif, int length, uint64_t code, SuffixIndex *index, int quorum, int max_mismatches, int k_min, int k_max, MotifCollector *found, MaxExtTable *max_ext, char* alphabet, int alphabet_size, OccurrenceStack *occurrences) {
     
     /*
         Recurive function that in lexicographical order adds nucleotides and checks if the new motifs are valid.
         In the max_ect table it stores the value of maximal extensibility for already visited suffixes and uses that
         info for earlier stopping if the egde doesn't lead to motif.
+        Motif of given length is also kept packed in code, max_ext is keyed by (length, packed prefix) and
+        the suffix of length s of a packed motif are just its lowest s characters.
+        Validity of a motif is checked on the occurrences of its parent carried in the occurrence stack,
+        so an extension only looks one character further from each point of the suffix tree that is still close enough.
+        Motifs of length between k_min and k_max are reported only when maximal, no valid extension of them
+        is at most k_max long. Returns whether some extension of motif is valid.
     */
-    
+    int bits = max_ext->bits;
+    int alpha_len = length + 1;
     char motif_alpha[MAX_MOTIF_LENGTH];
+    bool extended = false;
     for (int a = 0; a < alphabet_size; a++) {
         snprintf(motif_alpha, sizeof(motif_alpha), "%s%c", motif, alphabet[a]);
-        char *x = motif_alpha;
+        uint64_t alpha_code = (code << bits) | (uint64_t)a;
 
-        while (strlen(x) > 0 && lookup(max_ext, x) == -1) {
-            x++;
+        int x = alpha_len;
+        while (x > 0 && lookup(max_ext, x, alpha_code & suffix_mask(x, bits)) == -1) {
+            x--;
         }
 
-        if (strlen(x) > 0 && lookup(max_ext, x) + strlen(motif_alpha) < k_min) {
-            int value = lookup(max_ext, motif_alpha);
-            insert(max_ext, motif_alpha, value);
+        int bound = x > 0 ? lookup(max_ext, x, alpha_code & suffix_mask(x, bits)) : -1;
+        if (x > 0 && (long long)bound + alpha_len < k_min) {
+            /* Pruned motif can not get further than its suffix, parent's value has to see that instead of nothing. */
+            if (x < alpha_len) {
+                insert(max_ext, alpha_len, alpha_code, bound);
+            }
             continue;
         }
-        if (is_valid(motif_alpha, sequences, num_sequences, quorum, max_mismatches)) {
-            if (strlen(motif_alpha) >= k_min) {
-                valid_motifs[(*valid_motif_count)++] = strdup(motif_alpha);
-            }
-            if (strlen(motif_alpha) < k_max) {
-                extract_single_motif(motif_alpha, sequences, num_sequences, quorum, max_mismatches, k_min, k_max, valid_motifs, valid_motif_count, max_ext, alphabet, alphabet_size);
+        if (extend_occurrences(occurrences, length, alphabet[a], index, quorum, max_mismatches)) {
+            extended = true;
+            bool maximal = true;
+            if (alpha_len < k_max) {
+                maximal = !extract_single_motif(motif_alpha, alpha_len, alpha_code, index, quorum, max_mismatches, k_min, k_max, found, max_ext, alphabet, alphabet_size, occurrences);
             } else {
-                insert(max_ext, motif_alpha, INT_MAX);
+                insert(max_ext, alpha_len, alpha_code, INT_MAX);
+            }
+            if (alpha_len >= k_min) {
+                if (maximal) {
+                    collect_motif(found, motif_alpha);
+                }
+                record_extension(max_ext, alpha_len, alpha_code, k_min);
             }
         } else {
-            if (strlen(motif_alpha) < k_min) {
-                insert(max_ext, motif_alpha, 0);
+            if (alpha_len < k_min) {
+                insert(max_ext, alpha_len, alpha_code, 0);
             } else{ 
-                char motif_prefix[MAX_MOTIF_LENGTH];
-                int j = 0;
-                for (j = 0; j < (k_min - 1); j++){
-                    motif_prefix[j] = motif_alpha[j];
-                }
-                motif_prefix[j] = '\0';
-                if (lookup(max_ext, motif_prefix) < strlen(motif_alpha) - (k_min - 1)) {
-                    insert(max_ext, motif_prefix, strlen(motif_alpha) - (k_min - 1));
-                }
+                record_extension(max_ext, alpha_len, alpha_code, k_min);
             }
         }
     }
 
     /*Each node gets max_ext value that is taken from its child with maximum value and increased by 1*/
-    if (strlen(motif) < k_min - 1) {
+    if (length < k_min - 1) {
         int max_child = -1;
         for (int a = 0; a < alphabet_size; a++) {
-            char child[25];
-            char c = alphabet[a];
-            strcpy(child, motif);
-            char temp[2];
-            temp[0] = c;
-            temp[1] = '\0';
-            strcat(child, temp);
-            if (max_child < lookup(max_ext, child)){
-                max_child = lookup(max_ext, child);
+            int child = lookup(max_ext, alpha_len, (code << bits) | (uint64_t)a);
+            if (max_child < child){
+                max_child = child;
             }
         }
-        insert(max_ext, motif, max_child + 1);
+        insert(max_ext, length, code, max_child == INT_MAX ? INT_MAX : max_child + 1);
+    }
+    return extended;
+}
+
+void explore_task(Worker *worker, int task) {
+    /*
+        Task is one prefix of length prefix_len, the digits of the task number in base alphabet_size.
+        Occurrences of the prefix are rebuilt in the worker's own stack before the usual search continues below it.
+     */
+    int bits = worker->max_ext->bits;
+    char prefix[MAX_MOTIF_LENGTH];
+    int symbols[MAX_MOTIF_LENGTH];
+    for (int p = worker->prefix_len - 1; p >= 0; p--) {
+        symbols[p] = task % worker->alphabet_size;
+        task /= worker->alphabet_size;
+    }
+    uint64_t code = 0;
+    for (int p = 0; p < worker->prefix_len; p++) {
+        prefix[p] = worker->alphabet[symbols[p]];
+        code = (code << bits) | (uint64_t)symbols[p];
+        if (!extend_occurrences(&worker->occurrences, p, prefix[p], worker->index, worker->quorum, worker->max_mismatches)) {
+            insert(worker->max_ext, p + 1, code, 0);
+            return;
+        }
+    }
+    prefix[worker->prefix_len] = '\0';
+    extract_single_motif(prefix, worker->prefix_len, code, worker->index, worker->quorum, worker->max_mismatches, worker->k_min, worker->k_max, worker->found, worker->max_ext, worker->alphabet, worker->alphabet_size, &worker->occurrences);
+}
+
+void *run_worker(void *arg) {
+    Worker *worker = (Worker *)arg;
+    int task;
+    while (next_task(worker->tasks, &task)) {
+        explore_task(worker, task);
+    }
+    return NULL;
+}
+
+void extract_motifs_in_parallel(SuffixIndex *index, int quorum, int max_mismatches, int k_min, int k_max, MotifCollector *found, MaxExtTable *max_ext, char *alphabet, int alphabet_size, int num_threads) {
+    /*
+        Search tree is cut at prefixes shorter than k_min, so no motif is reported above the cut, and the prefixes
+        are spread over num_threads workers. Workers share max_ext, so a subtree ruled out by one prunes the others,
+        and each has its own occurrence stack. Motifs are sorted back into the order of the serial search,
+        unless they were written to a file as they were found.
+     */
+    int prefix_len = 0;
+    int num_tasks = 1;
+    while (prefix_len < k_min - 1 && num_tasks < num_threads * TASKS_PER_THREAD && alphabet_size > 1) {
+        prefix_len++;
+        num_tasks *= alphabet_size;
+    }
+
+    TaskQueue tasks = {0, num_tasks};
+    Worker *workers = (Worker *)malloc(num_threads * sizeof(Worker));
+    for (int t = 0; t < num_threads; t++) {
+        workers[t] = (Worker){&tasks, prefix_len, index, quorum, max_mismatches, k_min, k_max, max_ext, found, alphabet, alphabet_size, create_occurrence_stack(index, k_max)};
+    }
+    run_workers(run_worker, workers, sizeof(Worker), num_threads);
+
+    for (int t = 0; t < num_threads; t++) {
+        free_occurrence_stack(&workers[t].occurrences);
+    }
+    free(workers);
+
+    for (int a = 0; a < alphabet_size; a++) {
+        symbol_rank[(unsigned char)alphabet[a]] = a;
+    }
+    if (found->out == NULL) {
+        qsort(found->motifs, found->count, sizeof(char *), compare_motifs);
     }
 }
 
+double wall_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 char **read_lines_from_file(const char *file_path, int *num_lines) {
     FILE *file = fopen(file_path, "r");
     if (!file) {
@@ -206,6 +656,7 @@ char **read_lines_from_file(const char *file_path, int *num_lines) {
     *num_lines = 0;
 
     while (fgets(buffer, sizeof(buffer), file)) {
+        buffer[strcspn(buffer, "\n")] = '\0';
         lines[*num_lines] = strdup(buffer);
         (*num_lines)++;
     }
@@ -236,52 +687,119 @@ char* read_alphabet(const char *file_name, int *num_chars) {
 
 int main(int argc, char *argv[]) {
 
-    if (argc < 4) {
-        fprintf(stderr, "Argumenti: <duzina_motiva> <broj_mutacija> <datoteka_sa_sekvencama> [<datoteka_sa_azbukom>]\n");
+    /* Options may appear anywhere, what is left are positional arguments. */
+    int num_threads = 1;
+    int quorum = 0;
+    int max_length = 0;
+    char *output = NULL;
+    char *args[5];
+    int num_args = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            num_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--quorum") == 0 && i + 1 < argc) {
+            quorum = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-length") == 0 && i + 1 < argc) {
+            max_length = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (num_args < 5) {
+            args[num_args++] = argv[i];
+        }
+    }
+
+    if (num_args < 4) {
+        fprintf(stderr, "Argumenti: <duzina_motiva> <broj_mutacija> <datoteka_sa_sekvencama> [<datoteka_sa_azbukom>] [--threads <broj_niti>] [--quorum <q>] [--max-length <duzina>] [--output <datoteka>]\n");
         return 1;
     }
 
-    int l = atoi(argv[1]);
-    int d = atoi(argv[2]);
+    int l = atoi(args[1]);
+    int d = atoi(args[2]);
 
     if (l<0 || d<0){
         fprintf(stderr, "Argumenti duzina motiva i dozvoljene mutacije moraju biti veci od 0.\n");
         return 1;
     }
+    if (num_threads < 1) {
+        fprintf(stderr, "Broj niti mora biti veci od 0.\n");
+        return 1;
+    }
 
     int num_sequences;
-    char **sequences = read_lines_from_file(argv[3], &num_sequences);
+    char **sequences = read_lines_from_file(args[3], &num_sequences);
 
-    char *alphabet = (char *)malloc(25*sizeof(char));
+    char *alphabet;
     int alphabet_size;
 
-    if (argc == 5) {
-        alphabet = read_alphabet(argv[4], &alphabet_size);
+    if (num_args == 5) {
+        alphabet = read_alphabet(args[4], &alphabet_size);
     } else{
         alphabet = strdup("acgt");
         alphabet_size = 4;
     }
 
-    char *valid_motifs[MAX_VALID_MOTIFS];
-    int valid_motif_count = 0;
-    HashTable *max_ext = create_table(HASH_SIZE);
+    /* Motifs of length l up to max_length are searched in one pass, longer ones reuse max_ext of the shorter. */
+    if (quorum == 0) {
+        quorum = num_sequences;
+    }
+    if (max_length == 0) {
+        max_length = l;
+    }
+    if (quorum < 1 || quorum > num_sequences) {
+        fprintf(stderr, "Kvorum mora biti izmedju 1 i broja sekvenci (%d).\n", num_sequences);
+        return 1;
+    }
+    if (max_length < l || max_length >= MAX_MOTIF_LENGTH) {
+        fprintf(stderr, "Duzina motiva moze biti najvise %d, a najveca duzina ne moze biti manja od duzine motiva.\n", MAX_MOTIF_LENGTH - 1);
+        return 1;
+    }
+    MaxExtTable *max_ext = create_table(max_length, alphabet_size, num_threads > 1);
+    if (max_ext->bits * max_length > 64) {
+        fprintf(stderr, "Motiv duzine %d sa azbukom od %d karaktera ne staje u 64 bita.\n", max_length, alphabet_size);
+        return 1;
+    }
+    MotifCollector found = {NULL, 0, 0, NULL};
+    pthread_mutex_init(&found.lock, NULL);
+    if (output != NULL) {
+        found.out = fopen(output, "w");
+        if (found.out == NULL) {
+            fprintf(stderr, "Nije moguce otvoriti datoteku %s.\n", output);
+            return 1;
+        }
+    }
 
-    clock_t start = clock();
-    extract_single_motif("", sequences, num_sequences, num_sequences, d, l, l, valid_motifs, &valid_motif_count, max_ext, alphabet, alphabet_size);
-    clock_t end = clock();
+    double start = wall_time();
+    SuffixIndex index = build_suffix_index(sequences, num_sequences);
+    if (num_threads == 1) {
+        OccurrenceStack occurrences = create_occurrence_stack(&index, max_length);
+        extract_single_motif("", 0, 0, &index, quorum, d, l, max_length, &found, max_ext, alphabet, alphabet_size, &occurrences);
+        free_occurrence_stack(&occurrences);
+    } else {
+        extract_motifs_in_parallel(&index, quorum, d, l, max_length, &found, max_ext, alphabet, alphabet_size, num_threads);
+    }
+    free_suffix_index(&index);
+    double end = wall_time();
 
-    printf("Pronadjeni motivi: \n");
-    for (int i = 0; i < valid_motif_count; i++) {
-        printf("%s\n", valid_motifs[i]);
-        free(valid_motifs[i]);
+    if (found.out != NULL) {
+        fclose(found.out);
+        printf("Pronadjeno motiva: %d, upisani su u %s\n", found.count, output);
+    } else {
+        printf("Pronadjeni motivi: \n");
+        for (int i = 0; i < found.count; i++) {
+            printf("%s\n", found.motifs[i]);
+            free(found.motifs[i]);
+        }
     }
-    printf("Vreme: %lfs\n", (double)(end - start) / CLOCKS_PER_SEC);
+    printf("Vreme: %lfs\n", end - start);
+    printf("Memorija max_ext tabele: %zu KB\n", table_memory(max_ext) / 1024);
 
     for (int i = 0; i < num_sequences; i++) {
         free(sequences[i]);
     }
     free(sequences);
+    free(found.motifs);
+    pthread_mutex_destroy(&found.lock);
     free_table(max_ext);
     free(alphabet);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,42 @@
+#ifndef TASK_QUEUE_H
+#define TASK_QUEUE_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/*
+    Tasks next..count-1, all known before the workers start. They are handed out in increasing order
+    from one atomic counter, so a worker that got a cheap task simply takes the next one.
+ */
+typedef struct {
+    int next;
+    int count;
+} TaskQueue;
+
+static inline bool next_task(TaskQueue *queue, int *task) {
+    int taken = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED);
+    if (taken >= queue->count) {
+        return false;
+    }
+    *task = taken;
+    return true;
+}
+
+static inline void run_workers(void *(*run)(void *), void *workers, size_t worker_size, int num_threads) {
+    /* Calls run on each of num_threads workers laid out in an array, each on its own thread unless there is only one. */
+    if (num_threads == 1) {
+        run(workers);
+        return;
+    }
+    pthread_t *threads = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+    for (int t = 0; t < num_threads; t++) {
+        pthread_create(&threads[t], NULL, run, (char *)workers + t * worker_size);
+    }
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+}
+
+#endif
@@ -2,229 +2,681 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
-
-#define TABLE_SIZE 40000003
-#define MAX_VARIANTS 100000
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include "neighbourhood.h"
+#include "task_queue.h"
+
+#define INITIAL_TABLE_SIZE 65536
 #define MAX_LINES 1000
 #define MAX_BUFFER 1200
 #define MAX_LINE_LENGTH 100
+#define EMPTY_INDEX UINT32_MAX
+#define INITIAL_LIST_SIZE 1024
+#define DENSE_MEMORY_BUDGET (1ULL << 28)
+#define DEFAULT_SORT_MEMORY_MB 256
+#define MAX_MERGE_BUFFER 65536
+#define RADIX_BITS 8
+
+typedef struct {
+    kmer_t key;
+    int votes;
+    int last_seq;
+} Slot;
+
+typedef struct {
+    uint16_t votes;
+    uint16_t last_seq;
+} DenseSlot;
+
+typedef struct {
+    uint32_t *index;
+    Slot *entries;
+    size_t capacity;
+    size_t size;
+    size_t entries_capacity;
+    int shift;
+} VoteTable;
 
+typedef struct {
+    kmer_t *items;
+    size_t size;
+    size_t capacity;
+} KeyList;
 
-typedef struct Entry {
-    char *key;
-    int value;
-    struct Entry *next;
-} Entry;
+typedef struct {
+    kmer_t key;
+    int votes;
+} RankedMotif;
 
 typedef struct {
-    Entry **buckets;
-    int size;
-} HashTable;
+    RankedMotif *items;
+    size_t size;
+    size_t capacity;
+    size_t limit;
+} MotifRanking;
 
-unsigned int hash(const char *key, int table_size) {
-    unsigned long hash = 5381;
-    int c;
-    while ((c = *key++)) {
-        hash = ((hash << 5) + hash) + c;
+VoteTable* create_table(size_t capacity) {
+    /*
+        Capacity has to be a power of two. Entries are stored one after another in insertion order and the
+        open-addressed index only keeps their positions, EMPTY_INDEX marks a free index cell.
+     */
+    VoteTable *table = malloc(sizeof(VoteTable));
+    table->capacity = capacity;
+    table->size = 0;
+    table->shift = 64 - __builtin_ctzll(capacity);
+    table->index = malloc(capacity * sizeof(uint32_t));
+    table->entries_capacity = capacity / 2;
+    table->entries = malloc(table->entries_capacity * sizeof(Slot));
+    for (size_t i = 0; i < capacity; i++) {
+        table->index[i] = EMPTY_INDEX;
     }
-    return hash % table_size;
+    return table;
 }
 
-HashTable* create_table(int size) {
-    HashTable *table = malloc(sizeof(HashTable));
-    table->size = size;
-    table->buckets = calloc(size, sizeof(Entry*));
-    return table;
+size_t slot_index(VoteTable *table, kmer_t key) {
+    return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> table->shift);
+}
+
+uint32_t* find_slot(VoteTable *table, kmer_t key) {
+    /* Linear probing, returns the index cell pointing to key's entry or the empty cell where it would go. */
+    size_t mask = table->capacity - 1;
+    size_t i = slot_index(table, key);
+    while (table->index[i] != EMPTY_INDEX && table->entries[table->index[i]].key != key) {
+        i = (i + 1) & mask;
+    }
+    return &table->index[i];
+}
+
+void grow_table(VoteTable *table) {
+    /* Entries stay where they are, only the index is rebuilt twice as large. */
+    free(table->index);
+    table->capacity *= 2;
+    table->shift--;
+    table->index = malloc(table->capacity * sizeof(uint32_t));
+    if (table->index == NULL) {
+        perror("Failed to malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < table->capacity; i++) {
+        table->index[i] = EMPTY_INDEX;
+    }
+    for (size_t e = 0; e < table->size; e++) {
+        *find_slot(table, table->entries[e].key) = e;
+    }
 }
 
-void insert(HashTable *table, const char *key, int value) {
-    unsigned int bucket = hash(key, table->size);
-    Entry *current = table->buckets[bucket];
-    while (current != NULL) {
-        if (strcmp(current->key, key) == 0) {
-            current->value = value;
+void increment(VoteTable *table, kmer_t key, int i, int last_new_seq) {
+    /*
+        An l-mer first reached by sequence i can get at most num_sequences - i votes, so new keys are added
+        only while sequences up to last_new_seq vote. The last sequence that voted is kept in the
+        same slot as the count, so one sequence can give each key only one vote.
+     */
+    uint32_t *cell = find_slot(table, key);
+    if (*cell == EMPTY_INDEX) {
+        if (i > last_new_seq) {
             return;
         }
-        current = current->next;
+        if (2 * (table->size + 1) > table->capacity) {
+            grow_table(table);
+            cell = find_slot(table, key);
+        }
+        if (table->size == table->entries_capacity) {
+            table->entries_capacity *= 2;
+            table->entries = realloc(table->entries, table->entries_capacity * sizeof(Slot));
+            if (table->entries == NULL) {
+                perror("Failed to realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        *cell = table->size;
+        table->entries[table->size++] = (Slot){key, 1, i};
+    } else {
+        Slot *slot = &table->entries[*cell];
+        if (slot->last_seq != i) {
+            slot->votes++;
+            slot->last_seq = i;
+        }
     }
-    Entry *new_entry = malloc(sizeof(Entry));
-    new_entry->key = strdup(key);
-    new_entry->value = value;
-    new_entry->next = table->buckets[bucket];
-    table->buckets[bucket] = new_entry;
 }
 
-int lookup(HashTable *table, const char *key) {
-    unsigned int bucket = hash(key, table->size);
-    Entry *current = table->buckets[bucket];
-    while (current != NULL) {
-        if (strcmp(current->key, key) == 0) {
-            return current->value;
+void free_table(VoteTable *table) {
+    free(table->index);
+    free(table->entries);
+    free(table);
+}
+
+void add_key(KeyList *list, kmer_t key) {
+    if (list->size == list->capacity) {
+        list->capacity = list->capacity > 0 ? list->capacity * 2 : INITIAL_LIST_SIZE;
+        list->items = realloc(list->items, list->capacity * sizeof(kmer_t));
+        if (list->items == NULL) {
+            perror("Failed to realloc");
+            exit(EXIT_FAILURE);
         }
-        current = current->next;
     }
-    return -1;
+    list->items[list->size++] = key;
 }
 
-void increment(HashTable *table, HashTable *R, const char *key, int i) {
-    unsigned int bucket = hash(key, table->size);
-    Entry *current = table->buckets[bucket];
-    if (i==0 && lookup(R, key) != 0){
-        if (current == NULL){
-            Entry *new_entry = malloc(sizeof(Entry));
-            new_entry->key = strdup(key);
-            new_entry->value = 1;
-            new_entry->next = table->buckets[bucket];
-            table->buckets[bucket] = new_entry;
-            insert(R, key, i);
-        }
-    }else if (lookup(R, key) != i){
-        while (current != NULL) {
-            if (strcmp(current->key, key) == 0) {
-                current->value++;
-                insert(R, key, i);
-                return;
-            }
-            current = current->next;
+bool dense_fits(int l) {
+    /* Direct indexing needs one DenseSlot for each of the 4^l l-mers. */
+    return 2 * l < 64 && ((1ULL << (2 * l)) * sizeof(DenseSlot)) <= DENSE_MEMORY_BUDGET;
+}
+
+void increment_dense(DenseSlot *slots, KeyList *live, kmer_t key, int i, int last_new_seq) {
+    /* Same rules as increment, last_seq keeps i + 1 so that zero means no sequence voted yet. Added keys go to live. */
+    DenseSlot *slot = &slots[key];
+    if (slot->last_seq == 0) {
+        if (i <= last_new_seq) {
+            slot->votes = 1;
+            slot->last_seq = i + 1;
+            add_key(live, key);
         }
+    } else if (slot->last_seq != i + 1) {
+        slot->votes++;
+        slot->last_seq = i + 1;
     }
 }
 
-void free_table(HashTable *table) {
-    for (int i = 0; i < table->size; i++) {
-        Entry *current = table->buckets[i];
-        while (current != NULL) {
-            Entry *tmp = current;
-            current = current->next;
-            free(tmp->key);
-            free(tmp);
+bool ranks_lower(const RankedMotif *a, const RankedMotif *b) {
+    /* Fewer votes rank lower, equal votes are ordered lexicographically. */
+    return a->votes < b->votes || (a->votes == b->votes && a->key > b->key);
+}
+
+int compare_ranked(const void *a, const void *b) {
+    const RankedMotif *x = (const RankedMotif *)a;
+    const RankedMotif *y = (const RankedMotif *)b;
+    return ranks_lower(x, y) ? 1 : (ranks_lower(y, x) ? -1 : 0);
+}
+
+void sift_down_ranking(MotifRanking *ranking, size_t i) {
+    while (true) {
+        size_t lowest = i, left = 2 * i + 1, right = 2 * i + 2;
+        if (left < ranking->size && ranks_lower(&ranking->items[left], &ranking->items[lowest])) {
+            lowest = left;
         }
+        if (right < ranking->size && ranks_lower(&ranking->items[right], &ranking->items[lowest])) {
+            lowest = right;
+        }
+        if (lowest == i) {
+            return;
+        }
+        RankedMotif tmp = ranking->items[i];
+        ranking->items[i] = ranking->items[lowest];
+        ranking->items[lowest] = tmp;
+        i = lowest;
     }
-    free(table->buckets);
-    free(table);
 }
 
-char* slice(char *sequence, int start, int length) {
-    char *substring = malloc((length + 1) * sizeof(char));
-    if (substring == NULL) {
-        fprintf(stderr, "Memory allocation failed\n");
-        exit(1);
+void rank_motif(MotifRanking *ranking, kmer_t key, int votes) {
+    /*
+        Without a limit every motif is kept. With a limit the ranking is a min-heap of the best limit motifs,
+        its root is the lowest ranked one and a new motif only gets in by replacing it.
+     */
+    RankedMotif motif = {key, votes};
+    if (ranking->limit == 0 || ranking->size < ranking->limit) {
+        if (ranking->size == ranking->capacity) {
+            ranking->capacity = ranking->capacity > 0 ? ranking->capacity * 2 : INITIAL_LIST_SIZE;
+            ranking->items = realloc(ranking->items, ranking->capacity * sizeof(RankedMotif));
+        }
+        size_t i = ranking->size++;
+        ranking->items[i] = motif;
+        while (ranking->limit > 0 && i > 0 && ranks_lower(&ranking->items[i], &ranking->items[(i - 1) / 2])) {
+            RankedMotif tmp = ranking->items[i];
+            ranking->items[i] = ranking->items[(i - 1) / 2];
+            ranking->items[(i - 1) / 2] = tmp;
+            i = (i - 1) / 2;
+        }
+    } else if (ranks_lower(&ranking->items[0], &motif)) {
+        ranking->items[0] = motif;
+        sift_down_ranking(ranking, 0);
+    }
+}
+
+void print_ranking(MotifRanking *ranking, int l, char *alphabet, bool show_votes) {
+    /* Prints motifs from the most supported one, votes are shown when not every motif needs all sequences. */
+    if (ranking->size > 0) {
+        qsort(ranking->items, ranking->size, sizeof(RankedMotif), compare_ranked);
+    }
+    char motif[MAX_PACKED_LEN + 1];
+    for (size_t i = 0; i < ranking->size; i++) {
+        unpack_kmer(ranking->items[i].key, l, alphabet, motif);
+        if (show_votes) {
+            printf("Pronadjen motiv: %s glasova: %d\n", motif, ranking->items[i].votes);
+        } else {
+            printf("Pronadjen motiv: %s\n", motif);
+        }
     }
-    strncpy(substring, &sequence[start], length);
-    substring[length] = '\0';
-    return substring;
+    free(ranking->items);
 }
 
-void generate_neighbors(char *str, char *neighbor, int pos, int d, int length, char ***results, int *result_count, int *result_capacity, char* alphabet) {
+typedef struct {
+    VoteTable *table;
+    DenseSlot *dense;
+    KeyList live;
+    int seq;
+    int last_new_seq;
+} VoteContext;
+
+void vote(kmer_t neighbour, void *ctx) {
+    VoteContext *context = (VoteContext *)ctx;
+    increment(context->table, neighbour, context->seq, context->last_new_seq);
+}
+
+void vote_dense(kmer_t neighbour, void *ctx) {
+    VoteContext *context = (VoteContext *)ctx;
+    increment_dense(context->dense, &context->live, neighbour, context->seq, context->last_new_seq);
+}
+
+typedef struct {
+    VoteContext *global;
+    char **sequences;
+    int l;
+    int d;
+    int alphabet_size;
+    const int *codes;
+    TaskQueue *tasks;
+    uint64_t *seen;
+    size_t *touched;
+    size_t touched_size;
+    size_t touched_capacity;
+} VoteWorker;
+
+void mark_seen(kmer_t neighbour, void *ctx) {
     /*
-        Recursive function that finds all neighbours until differences are less or equal to d.
-        There are two cases, when recursive function is called but we keep the character on position pos, and d stays the same.
-        Second case is when the letter is changed with all 3 different nucleotids and recursive call is made with d-1.
-    */
-    
-    if (d < 0) {
+        No l-mer is added once sequences past last_new_seq vote, so an entry index identifies the l-mer.
+        Worker remembers each entry its current sequence reaches in a bitmap and a list, l-mers without an entry are ignored.
+     */
+    VoteWorker *worker = (VoteWorker *)ctx;
+    size_t index;
+    if (worker->global->dense) {
+        if (worker->global->dense[neighbour].last_seq == 0) {
+            return;
+        }
+        index = neighbour;
+    } else {
+        uint32_t cell = *find_slot(worker->global->table, neighbour);
+        if (cell == EMPTY_INDEX) {
+            return;
+        }
+        index = cell;
+    }
+    uint64_t bit = 1ULL << (index & 63);
+    if (worker->seen[index >> 6] & bit) {
         return;
     }
-    if (pos == length) {
-        if (*result_count >= *result_capacity) {
-            *result_capacity *= 4;
-            *results = realloc(*results, *result_capacity * sizeof(char *));
-            if (*results == NULL) {
-                perror("Failed to realloc");
-                exit(EXIT_FAILURE);
+    worker->seen[index >> 6] |= bit;
+    if (worker->touched_size == worker->touched_capacity) {
+        worker->touched_capacity *= 2;
+        worker->touched = realloc(worker->touched, worker->touched_capacity * sizeof(size_t));
+        if (worker->touched == NULL) {
+            perror("Failed to realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    worker->touched[worker->touched_size++] = index;
+}
+
+void *run_vote_worker(void *arg) {
+    /* Takes sequences one at a time, after each one adds a single vote to every entry it reached and clears its set. */
+    VoteWorker *worker = (VoteWorker *)arg;
+    int i;
+    while (next_task(worker->tasks, &i)) {
+        char *seq = worker->sequences[i];
+        int seq_len = strlen(seq);
+        for (int j = 0; j <= seq_len - worker->l; j++) {
+            kmer_t bad;
+            kmer_t lmer = pack_kmer(&seq[j], worker->l, worker->codes, &bad);
+            for_each_neighbour(lmer, bad, worker->l, worker->d, worker->alphabet_size, mark_seen, worker);
+        }
+        for (size_t t = 0; t < worker->touched_size; t++) {
+            size_t index = worker->touched[t];
+            if (worker->global->dense) {
+                __atomic_fetch_add(&worker->global->dense[index].votes, 1, __ATOMIC_RELAXED);
+            } else {
+                __atomic_fetch_add(&worker->global->table->entries[index].votes, 1, __ATOMIC_RELAXED);
             }
+            worker->seen[index >> 6] &= ~(1ULL << (index & 63));
         }
-        (*results)[*result_count] = strdup(neighbor);
-        if ((*results)[*result_count] == NULL) {
-            perror("Failed to strdup");
+        worker->touched_size = 0;
+    }
+    return NULL;
+}
+
+void vote_in_parallel(VoteContext *global, size_t num_slots, char **sequences, int first_seq, int num_sequences, int l, int d, int alphabet_size, const int *codes, int num_threads) {
+    /* Sequences from first_seq on vote on num_threads threads, the ones before it have to be done already. */
+    TaskQueue tasks = {first_seq, num_sequences};
+    VoteWorker *workers = malloc(num_threads * sizeof(VoteWorker));
+    for (int t = 0; t < num_threads; t++) {
+        VoteWorker *worker = &workers[t];
+        worker->global = global;
+        worker->sequences = sequences;
+        worker->l = l;
+        worker->d = d;
+        worker->alphabet_size = alphabet_size;
+        worker->codes = codes;
+        worker->tasks = &tasks;
+        worker->seen = calloc((num_slots + 63) / 64 + 1, sizeof(uint64_t));
+        worker->touched_capacity = INITIAL_LIST_SIZE;
+        worker->touched_size = 0;
+        worker->touched = malloc(worker->touched_capacity * sizeof(size_t));
+        if (worker->seen == NULL || worker->touched == NULL) {
+            perror("Failed to malloc");
             exit(EXIT_FAILURE);
         }
-        (*result_count)++;
-        return;
     }
+    run_workers(run_vote_worker, workers, sizeof(VoteWorker), num_threads);
+    for (int t = 0; t < num_threads; t++) {
+        free(workers[t].seen);
+        free(workers[t].touched);
+    }
+    free(workers);
+}
+
+void voting_algorthm(char **sequences, int num_sequences, int l, int d, char* alphabet, int alphabet_size, int num_threads, int quorum, int top_k) {
+    /*
+        Initialization of vote table V, it keeps votes and the sequence that voted last for each l-mer packed in 2 bits per character.
+        When all 4^l l-mers fit in DENSE_MEMORY_BUDGET, V is a flat array indexed by the packed l-mer instead of a hash table.
+        For each lmer from the input sequences, find all its neighbors and increment the result for all its neighbors in table V.
+        A character outside of the alphabet is a mismatch with every l-mer, so such a window votes for l-mers with any character there.
+        It is not allowed for more than one l-mer from the same string to cast more than one vote for one neighbor.
+        With more than one thread the sequences that can still add l-mers vote alone and the rest are spread over threads, see vote_in_parallel.
+        After voting step is done, l-mers with at least quorum votes are ranked and the top_k of them printed (all if top_k is 0).
+    */
+    bool dense = dense_fits(l);
+    size_t dense_size = dense ? (size_t)1 << (2 * l) : 0;
+    VoteContext context = {NULL, NULL, {NULL, 0, 0}, 0, num_sequences - quorum};
+    if (dense) {
+        context.dense = calloc(dense_size, sizeof(DenseSlot));
+        if (context.dense == NULL) {
+            perror("Failed to calloc");
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        context.table = create_table(INITIAL_TABLE_SIZE);
+    }
+    printf("Nacin glasanja: %s\n", dense ? "niz" : "hes tabela");
 
-    neighbor[pos] = str[pos];
-    generate_neighbors(str, neighbor, pos + 1, d, length, results, result_count, result_capacity, alphabet);
+    int codes[256];
+    build_symbol_codes(alphabet, alphabet_size, codes);
+    neighbour_fn fn = dense ? vote_dense : vote;
 
-    for (int i = 0; alphabet[i] != '\0'; i++) {
-        if (alphabet[i] != str[pos]) {
-            neighbor[pos] = alphabet[i];
-            generate_neighbors(str, neighbor, pos + 1, d - 1, length, results, result_count, result_capacity, alphabet);
+    int serial_sequences = num_sequences;
+    if (num_threads > 1 && context.last_new_seq + 1 < num_sequences) {
+        serial_sequences = context.last_new_seq + 1;
+    }
+    for (int i = 0; i < serial_sequences; i++) {
+        int seq_len = strlen(sequences[i]);
+        context.seq = i;
+        for (int j = 0; j <= seq_len - l; j++) {
+            kmer_t bad;
+            kmer_t lmer = pack_kmer(&sequences[i][j], l, codes, &bad);
+            for_each_neighbour(lmer, bad, l, d, alphabet_size, fn, &context);
         }
     }
+
+    if (serial_sequences < num_sequences) {
+        size_t num_slots = dense ? dense_size : context.table->size;
+        vote_in_parallel(&context, num_slots, sequences, serial_sequences, num_sequences, l, d, alphabet_size, codes, num_threads);
+    }
+
+    MotifRanking ranking = {NULL, 0, 0, top_k};
+    if (dense) {
+        for (size_t i = 0; i < context.live.size; i++) {
+            kmer_t key = context.live.items[i];
+            if (context.dense[key].votes >= quorum) {
+                rank_motif(&ranking, key, context.dense[key].votes);
+            }
+        }
+        free(context.live.items);
+        free(context.dense);
+    } else {
+        VoteTable *V = context.table;
+        for (size_t i = 0; i < V->size; i++) {
+            if (V->entries[i].votes >= quorum) {
+                rank_motif(&ranking, V->entries[i].key, V->entries[i].votes);
+            }
+        }
+        free_table(V);
+    }
+    print_ranking(&ranking, l, alphabet, quorum < num_sequences || top_k > 0);
 }
 
-void get_variants(char *s, int d, char ***variants, int *count, char* alphabet) {
-    /*
-        Allocate memory for neighbours of lmer s and call recursive function for finding them all.
-     */
-    int length = strlen(s);
-    int capacity = MAX_VARIANTS;
-    *variants = malloc(capacity * sizeof(char *));
-    if (*variants == NULL) {
-        perror("Failed to malloc");
-        exit(EXIT_FAILURE);
+typedef struct {
+    long offset;
+    long length;
+    int seq;
+    kmer_t *buffer;
+    long buffered;
+    long pos;
+    long consumed;
+} Run;
+
+typedef struct {
+    kmer_t *keys;
+    kmer_t *scratch;
+    size_t size;
+    size_t capacity;
+    int seq;
+    int l;
+    FILE *spill;
+    long spilled;
+    Run *runs;
+    int num_runs;
+    int runs_capacity;
+} SortContext;
+
+int compare_kmers(const void *a, const void *b) {
+    kmer_t x = *(const kmer_t *)a;
+    kmer_t y = *(const kmer_t *)b;
+    return (x > y) - (x < y);
+}
+
+void radix_sort(kmer_t *keys, kmer_t *scratch, size_t count, int l) {
+    /* LSD radix sort over the 2l used bits, RADIX_BITS at a time, bouncing between keys and scratch. */
+    size_t buckets[1 << RADIX_BITS];
+    kmer_t *from = keys, *to = scratch;
+    for (int shift = 0; shift < 2 * l; shift += RADIX_BITS) {
+        memset(buckets, 0, sizeof(buckets));
+        for (size_t i = 0; i < count; i++) {
+            buckets[(from[i] >> shift) & ((1 << RADIX_BITS) - 1)]++;
+        }
+        size_t sum = 0;
+        for (int b = 0; b < (1 << RADIX_BITS); b++) {
+            size_t c = buckets[b];
+            buckets[b] = sum;
+            sum += c;
+        }
+        for (size_t i = 0; i < count; i++) {
+            to[buckets[(from[i] >> shift) & ((1 << RADIX_BITS) - 1)]++] = from[i];
+        }
+        kmer_t *tmp = from;
+        from = to;
+        to = tmp;
     }
-    char *neighbor = malloc(length + 1);
-    if (neighbor == NULL) {
-        perror("Failed to malloc");
+    if (from != keys) {
+        memcpy(keys, from, count * sizeof(kmer_t));
+    }
+}
+
+void flush_run(SortContext *context) {
+    /* Sort and deduplicate the buffered neighbours of the current sequence and append them to the spill file as one run. */
+    if (context->size == 0) {
+        return;
+    }
+    if (context->scratch) {
+        radix_sort(context->keys, context->scratch, context->size, context->l);
+    } else {
+        qsort(context->keys, context->size, sizeof(kmer_t), compare_kmers);
+    }
+    size_t unique = 1;
+    for (size_t i = 1; i < context->size; i++) {
+        if (context->keys[i] != context->keys[unique - 1]) {
+            context->keys[unique++] = context->keys[i];
+        }
+    }
+    if (fwrite(context->keys, sizeof(kmer_t), unique, context->spill) != unique) {
+        perror("Failed to write spill file");
         exit(EXIT_FAILURE);
     }
-    neighbor[length] = '\0';
 
-    *count = 0;
-    generate_neighbors(s, neighbor, 0, d, length, variants, count, &capacity, alphabet);
+    if (context->num_runs == context->runs_capacity) {
+        context->runs_capacity *= 2;
+        context->runs = realloc(context->runs, context->runs_capacity * sizeof(Run));
+    }
+    Run *run = &context->runs[context->num_runs++];
+    run->offset = context->spilled;
+    run->length = unique;
+    run->seq = context->seq;
+    context->spilled += unique;
+    context->size = 0;
+}
 
-    free(neighbor);
+void collect(kmer_t neighbour, void *ctx) {
+    SortContext *context = (SortContext *)ctx;
+    if (context->size == context->capacity) {
+        flush_run(context);
+    }
+    context->keys[context->size++] = neighbour;
 }
 
-void voting_algorthm(char **sequences, int num_sequences, int l, int d, char* alphabet) {
+bool refill_run(Run *run, FILE *spill, long buffer_size) {
+    long left = run->length - run->consumed;
+    if (left <= 0) {
+        return false;
+    }
+    long count = left < buffer_size ? left : buffer_size;
+    fseek(spill, (run->offset + run->consumed) * sizeof(kmer_t), SEEK_SET);
+    if (fread(run->buffer, sizeof(kmer_t), count, spill) != (size_t)count) {
+        perror("Failed to read spill file");
+        exit(EXIT_FAILURE);
+    }
+    run->buffered = count;
+    run->pos = 0;
+    run->consumed += count;
+    return true;
+}
+
+void sift_down(Run **heap, int size, int i) {
+    while (true) {
+        int smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+        if (left < size && heap[left]->buffer[heap[left]->pos] < heap[smallest]->buffer[heap[smallest]->pos]) {
+            smallest = left;
+        }
+        if (right < size && heap[right]->buffer[heap[right]->pos] < heap[smallest]->buffer[heap[smallest]->pos]) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        Run *tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+void voting_sort_and_count(char **sequences, int num_sequences, int l, int d, char* alphabet, int alphabet_size, long memory_mb, bool radix, int quorum, int top_k) {
     /*
-        Initialization of hash tables, V to count votes and R to keep track of which sequence voted.
-        For each lmer from the input sequences, find all its neighbors and increment the result for all its neighbors in table V.
-        It is not allowed for more than one l-mer from the same string to cast more than one vote for one neighbor.
-        After voting step is done, next step is checking votes and printing found motifs.
+        Voting without a table: neighbours of each sequence are collected into a buffer of at most memory_mb,
+        sorted, deduplicated and spilled to a temporary file as runs. Runs are then merged with a heap, equal l-mers
+        come out together and the number of different sequences among their runs is the number of votes.
+        Memory stays within memory_mb and both sorting and merging access memory sequentially.
+        L-mers with at least quorum votes are ranked the same way as in voting_algorthm.
     */
-    HashTable *V = create_table(TABLE_SIZE);
-    HashTable *R = create_table(TABLE_SIZE);
+    printf("Nacin glasanja: sortiranje\n");
+    size_t memory = (size_t)memory_mb << 20;
+    SortContext context;
+    context.capacity = memory / (radix ? 2 * sizeof(kmer_t) : sizeof(kmer_t));
+    if (context.capacity == 0) {
+        context.capacity = 1;
+    }
+    context.keys = malloc(context.capacity * sizeof(kmer_t));
+    context.scratch = radix ? malloc(context.capacity * sizeof(kmer_t)) : NULL;
+    context.size = 0;
+    context.l = l;
+    context.spill = tmpfile();
+    context.spilled = 0;
+    context.runs_capacity = 64;
+    context.num_runs = 0;
+    context.runs = malloc(context.runs_capacity * sizeof(Run));
+    if (context.keys == NULL || (radix && context.scratch == NULL) || context.spill == NULL) {
+        perror("Failed to prepare sorting");
+        exit(EXIT_FAILURE);
+    }
 
+    int codes[256];
+    build_symbol_codes(alphabet, alphabet_size, codes);
     for (int i = 0; i < num_sequences; i++) {
-        for (int j = 0; j <= strlen(sequences[i]) - l; j++) {
-            char *lmer = slice(sequences[i], j, l);
-            char **variants;
-            int variant_count;
-            get_variants(lmer, d, &variants, &variant_count, alphabet);
-
-            for (int k = 0; k < variant_count; k++) {
-                char *variant = variants[k];
-                increment(V, R, variant, i);
-                // if (lookup(R, variant) != i) {
-                //     increment(V, variant, i);
-                //     insert(R, variant, i);
-                // }
-            }
-            for (int k = 0; k < variant_count; k++) {
-                free(variants[k]);
-            }
-            free(lmer);
-            free(variants);
+        int seq_len = strlen(sequences[i]);
+        context.seq = i;
+        for (int j = 0; j <= seq_len - l; j++) {
+            kmer_t bad;
+            kmer_t lmer = pack_kmer(&sequences[i][j], l, codes, &bad);
+            for_each_neighbour(lmer, bad, l, d, alphabet_size, collect, &context);
         }
+        flush_run(&context);
     }
+    free(context.keys);
+    free(context.scratch);
+    fflush(context.spill);
 
-    for (int i = 0; i < TABLE_SIZE; i++) {
-        Entry *entry = V->buckets[i];
-        if (entry == NULL) {
-            continue;
+    long buffer_size = context.num_runs > 0 ? (long)(memory / sizeof(kmer_t) / context.num_runs) : 1;
+    if (buffer_size > MAX_MERGE_BUFFER) {
+        buffer_size = MAX_MERGE_BUFFER;
+    }
+    if (buffer_size < 1) {
+        buffer_size = 1;
+    }
+    Run **heap = malloc((context.num_runs > 0 ? context.num_runs : 1) * sizeof(Run *));
+    int heap_size = 0;
+    for (int r = 0; r < context.num_runs; r++) {
+        Run *run = &context.runs[r];
+        run->buffer = malloc(buffer_size * sizeof(kmer_t));
+        run->consumed = 0;
+        if (refill_run(run, context.spill, buffer_size)) {
+            heap[heap_size++] = run;
         }
-        while (entry != NULL) {
-            if (entry->value == num_sequences){
-                printf("Pronadjen motiv: %s\n", entry->key);
+    }
+    for (int i = heap_size / 2 - 1; i >= 0; i--) {
+        sift_down(heap, heap_size, i);
+    }
+
+    /* A sequence can have more than one run, counted_at remembers the last l-mer each sequence was counted for. */
+    long *counted_at = calloc(num_sequences > 0 ? num_sequences : 1, sizeof(long));
+    long step = 0;
+    MotifRanking ranking = {NULL, 0, 0, top_k};
+    while (heap_size > 0) {
+        kmer_t key = heap[0]->buffer[heap[0]->pos];
+        int votes = 0;
+        step++;
+        while (heap_size > 0 && heap[0]->buffer[heap[0]->pos] == key) {
+            Run *run = heap[0];
+            if (counted_at[run->seq] != step) {
+                counted_at[run->seq] = step;
+                votes++;
             }
-            entry = entry->next;
+            run->pos++;
+            if (run->pos == run->buffered && !refill_run(run, context.spill, buffer_size)) {
+                heap[0] = heap[--heap_size];
+            }
+            sift_down(heap, heap_size, 0);
+        }
+        if (votes >= quorum) {
+            rank_motif(&ranking, key, votes);
         }
     }
-    free_table(V);
-    free_table(R);
+    print_ranking(&ranking, l, alphabet, quorum < num_sequences || top_k > 0);
+
+    for (int r = 0; r < context.num_runs; r++) {
+        free(context.runs[r].buffer);
+    }
+    free(counted_at);
+    free(heap);
+    free(context.runs);
+    fclose(context.spill);
 }
 
 char **read_lines_from_file(const char *file_path, int *num_lines) {
@@ -239,6 +691,7 @@ char **read_lines_from_file(const char *file_path, int *num_lines) {
     *num_lines = 0;
 
     while (fgets(buffer, sizeof(buffer), file)) {
+        buffer[strcspn(buffer, "\n")] = '\0';
         lines[*num_lines] = strdup(buffer);
         (*num_lines)++;
     }
@@ -266,39 +719,107 @@ char* read_alphabet(const char *file_name, int *num_chars) {
     }
 }
 
+double wall_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 int main(int argc, char *argv[]) {
 
-    if (argc < 4) {
-        fprintf(stderr, "Argumenti: <duzina_motiva> <broj_mutacija> <datoteka_sa_sekvencama> [<datoteka_sa_azbukom>]\n");
+    /* Options may appear anywhere, what is left are positional arguments. */
+    int num_threads = 1;
+    bool sort_backend = false;
+    bool radix = false;
+    long memory_mb = DEFAULT_SORT_MEMORY_MB;
+    int quorum = 0;
+    int top_k = 0;
+    char *args[5];
+    int num_args = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            num_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "sort") == 0) {
+                sort_backend = true;
+            } else if (strcmp(argv[i], "table") != 0) {
+                fprintf(stderr, "Nepoznat nacin glasanja: %s (table ili sort).\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--memory-mb") == 0 && i + 1 < argc) {
+            memory_mb = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--quorum") == 0 && i + 1 < argc) {
+            quorum = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+            top_k = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--radix") == 0) {
+            radix = true;
+        } else if (num_args < 5) {
+            args[num_args++] = argv[i];
+        }
+    }
+
+    if (num_args < 4) {
+        fprintf(stderr, "Argumenti: <duzina_motiva> <broj_mutacija> <datoteka_sa_sekvencama> [<datoteka_sa_azbukom>] [--threads <broj_niti>] [--backend table|sort] [--memory-mb <MB>] [--radix] [--quorum <q>] [--top <K>]\n");
         return 1;
     }
 
-    int l = atoi(argv[1]);
-    int d = atoi(argv[2]);
+    int l = atoi(args[1]);
+    int d = atoi(args[2]);
 
     if (l<0 || d<0){
         fprintf(stderr, "Argumenti duzina motiva i broj dozvoljenih mutacije moraju biti veci od 0.\n");
         return 1;
     }
+    if (num_threads < 1) {
+        fprintf(stderr, "Broj niti mora biti veci od 0.\n");
+        return 1;
+    }
+    if (memory_mb < 1) {
+        fprintf(stderr, "Ogranicenje memorije mora biti vece od 0 MB.\n");
+        return 1;
+    }
 
     int num_sequences;
-    char **sequences = read_lines_from_file(argv[3], &num_sequences);
+    char **sequences = read_lines_from_file(args[3], &num_sequences);
 
-    char *alphabet = (char *)malloc(25*sizeof(char));
+    char *alphabet;
     int alphabet_size;
 
-    if (argc == 5) {
-        alphabet = read_alphabet(argv[4], &alphabet_size);
+    if (num_args == 5) {
+        alphabet = read_alphabet(args[4], &alphabet_size);
     } else{
         alphabet = strdup("acgt");
         alphabet_size = 4;
     }
 
-    clock_t start = clock();
-    voting_algorthm(sequences, num_sequences, l, d, alphabet);
-    clock_t end = clock();
+    if (alphabet_size > 4 || l > MAX_PACKED_LEN) {
+        fprintf(stderr, "Azbuka moze imati najvise 4 karaktera, a duzina motiva najvise %d.\n", MAX_PACKED_LEN);
+        return 1;
+    }
+
+    if (quorum == 0) {
+        quorum = num_sequences;
+    }
+    if (quorum < 1 || quorum > num_sequences || top_k < 0) {
+        fprintf(stderr, "Kvorum mora biti izmedju 1 i broja sekvenci (%d), a broj najboljih motiva ne sme biti negativan.\n", num_sequences);
+        return 1;
+    }
+
+    double start = wall_time();
+    if (sort_backend) {
+        voting_sort_and_count(sequences, num_sequences, l, d, alphabet, alphabet_size, memory_mb, radix, quorum, top_k);
+    } else {
+        voting_algorthm(sequences, num_sequences, l, d, alphabet, alphabet_size, num_threads, quorum, top_k);
+    }
+    double end = wall_time();
+
+    printf("Vreme: %lfs\n", end - start);
 
-    printf("Vreme: %lfs\n", (double)(end - start) / CLOCKS_PER_SEC);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("Maksimalna memorija: %ld KB\n", usage.ru_maxrss);
     
     for (int i = 0; i < num_sequences; i++) {
         free(sequences[i]);